@@ -0,0 +1,306 @@
+#include "baseline.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+namespace Baseline
+{
+	namespace
+	{
+		const int FormatVersion = 1;
+
+		// Just enough JSON to read back what Save writes
+		struct JsonValue
+		{
+			enum class Type { Null, Number, String, Array, Object };
+			Type type = Type::Null;
+			double number = 0;
+			std::string string;
+			std::vector<JsonValue> array;
+			std::map<std::string, JsonValue> object;
+
+			const JsonValue& operator[](const std::string& key) const
+			{
+				auto iter = object.find(key);
+				if (type != Type::Object || iter == object.end())
+					throw std::runtime_error("Missing key '" + key + "' in baseline");
+				return iter->second;
+			}
+		};
+
+		class JsonParser
+		{
+		public:
+			explicit JsonParser(const std::string& text) : m_text(text) {}
+
+			JsonValue ParseDocument()
+			{
+				auto value = ParseValue();
+				SkipWhitespace();
+				if (m_pos != m_text.size())
+					Fail("trailing characters");
+				return value;
+			}
+
+		private:
+			[[noreturn]] void Fail(const char* what)
+			{
+				throw std::runtime_error(std::string("Malformed baseline JSON: ") + what + " at offset " + std::to_string(m_pos));
+			}
+
+			void SkipWhitespace()
+			{
+				while (m_pos < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_pos])))
+					++m_pos;
+			}
+
+			bool Consume(char c)
+			{
+				SkipWhitespace();
+				if (m_pos < m_text.size() && m_text[m_pos] == c)
+				{
+					++m_pos;
+					return true;
+				}
+				return false;
+			}
+
+			void Expect(char c)
+			{
+				if (!Consume(c))
+					Fail("unexpected character");
+			}
+
+			std::string ParseString()
+			{
+				Expect('"');
+				std::string result;
+				while (m_pos < m_text.size() && m_text[m_pos] != '"')
+				{
+					if (m_text[m_pos] == '\\' && m_pos + 1 < m_text.size())
+						++m_pos;
+					result += m_text[m_pos++];
+				}
+				Expect('"');
+				return result;
+			}
+
+			JsonValue ParseValue()
+			{
+				JsonValue value;
+				SkipWhitespace();
+				if (m_pos >= m_text.size())
+					Fail("unexpected end");
+
+				const char c = m_text[m_pos];
+				if (c == '{')
+				{
+					value.type = JsonValue::Type::Object;
+					++m_pos;
+					if (!Consume('}'))
+					{
+						do
+						{
+							auto key = ParseString();
+							Expect(':');
+							value.object[key] = ParseValue();
+						} while (Consume(','));
+						Expect('}');
+					}
+				}
+				else if (c == '[')
+				{
+					value.type = JsonValue::Type::Array;
+					++m_pos;
+					if (!Consume(']'))
+					{
+						do
+						{
+							value.array.push_back(ParseValue());
+						} while (Consume(','));
+						Expect(']');
+					}
+				}
+				else if (c == '"')
+				{
+					value.type = JsonValue::Type::String;
+					value.string = ParseString();
+				}
+				else if (m_text.compare(m_pos, 4, "null") == 0)
+				{
+					m_pos += 4;
+				}
+				else
+				{
+					const char* begin = m_text.c_str() + m_pos;
+					char* end = nullptr;
+					value.type = JsonValue::Type::Number;
+					value.number = std::strtod(begin, &end);
+					if (end == begin)
+						Fail("expected a value");
+					m_pos += end - begin;
+				}
+				return value;
+			}
+
+			const std::string& m_text;
+			size_t m_pos = 0;
+		};
+
+		void WriteJsonString(std::ostream& os, const std::string& s)
+		{
+			os << '"';
+			for (char c : s)
+			{
+				if (c == '"' || c == '\\')
+					os << '\\';
+				os << c;
+			}
+			os << '"';
+		}
+	}
+
+	bool Save(const std::string& path, const std::vector<BenchmarkResult>& results)
+	{
+		std::ofstream file(path);
+		if (!file)
+			return false;
+
+		file << std::setprecision(17);
+		file << "{\n  \"version\": " << FormatVersion << ",\n  \"benchmarks\": [";
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const auto& result = results[i];
+			file << (i > 0 ? ",\n" : "\n") << "    {\"name\": ";
+			WriteJsonString(file, result.name);
+			file << ", \"tokensPerOp\": " << result.tokensPerOp
+				<< ", \"bytesPerOp\": " << result.bytesPerOp
+				<< ", \"allocationsPerOp\": " << result.allocationsPerOp
+				<< ", \"nsPerOp\": [";
+			for (size_t j = 0; j < result.nsPerOp.size(); ++j)
+				file << (j > 0 ? ", " : "") << result.nsPerOp[j];
+			file << "]}";
+		}
+		file << "\n  ]\n}\n";
+		return static_cast<bool>(file);
+	}
+
+	std::vector<BenchmarkResult> Load(const std::string& path)
+	{
+		std::ifstream file(path);
+		if (!file)
+			throw std::runtime_error("Cannot open baseline " + path);
+
+		std::stringstream contents;
+		contents << file.rdbuf();
+		const auto text = contents.str();
+		const auto document = JsonParser(text).ParseDocument();
+
+		if (static_cast<int>(document["version"].number) != FormatVersion)
+			throw std::runtime_error("Unsupported baseline version in " + path);
+
+		std::vector<BenchmarkResult> results;
+		for (auto&& entry : document["benchmarks"].array)
+		{
+			BenchmarkResult result;
+			result.name = entry["name"].string;
+			result.tokensPerOp = entry["tokensPerOp"].number;
+			result.bytesPerOp = entry["bytesPerOp"].number;
+			result.allocationsPerOp = entry["allocationsPerOp"].number;
+			for (auto&& sample : entry["nsPerOp"].array)
+				result.nsPerOp.push_back(sample.number);
+			results.push_back(std::move(result));
+		}
+		return results;
+	}
+
+	double MannWhitneyPValue(const std::vector<double>& a, const std::vector<double>& b)
+	{
+		const double na = static_cast<double>(a.size());
+		const double nb = static_cast<double>(b.size());
+		if (a.empty() || b.empty())
+			return 1;
+
+		// Rank the pooled samples, giving tied values their average rank
+		std::vector<std::pair<double, bool>> pooled; // (value, isFromB)
+		for (auto v : a)
+			pooled.emplace_back(v, false);
+		for (auto v : b)
+			pooled.emplace_back(v, true);
+		std::sort(pooled.begin(), pooled.end());
+
+		double rankSumB = 0;
+		double tieCorrection = 0;
+		for (size_t i = 0; i < pooled.size(); )
+		{
+			size_t j = i;
+			while (j < pooled.size() && pooled[j].first == pooled[i].first)
+				++j;
+			const double averageRank = (i + 1 + j) / 2.0;
+			for (size_t k = i; k < j; ++k)
+			{
+				if (pooled[k].second)
+					rankSumB += averageRank;
+			}
+			const double t = static_cast<double>(j - i);
+			tieCorrection += t * t * t - t;
+			i = j;
+		}
+
+		// Normal approximation with tie and continuity corrections
+		const double n = na + nb;
+		const double u = rankSumB - nb * (nb + 1) / 2;
+		const double mean = na * nb / 2;
+		const double variance = na * nb / 12 * ((n + 1) - tieCorrection / (n * (n - 1)));
+		if (variance <= 0)
+			return 1;
+		const double z = (u - mean - 0.5) / std::sqrt(variance);
+		return 0.5 * std::erfc(z / std::sqrt(2.0));
+	}
+
+	int Compare(const std::vector<BenchmarkResult>& baseline, const std::vector<BenchmarkResult>& current, const CompareOptions& options, std::ostream& os)
+	{
+		std::map<std::string, const BenchmarkResult*> baselineByName;
+		for (auto&& result : baseline)
+			baselineByName[result.name] = &result;
+
+		os << "\n" << std::left << std::setw(64) << "Benchmark" << std::right
+			<< std::setw(14) << "baseline ns" << std::setw(14) << "current ns" << std::setw(10) << "change" << std::setw(10) << "p-value" << "\n";
+
+		int numRegressions = 0;
+		for (auto&& result : current)
+		{
+			auto iter = baselineByName.find(result.name);
+			if (iter == baselineByName.end())
+			{
+				os << std::left << std::setw(64) << result.name << std::right << "  (not in baseline)\n";
+				continue;
+			}
+
+			const auto& base = *iter->second;
+			const double baseMedian = base.Median();
+			const double currentMedian = result.Median();
+			const double changePercent = baseMedian > 0 ? (currentMedian / baseMedian - 1) * 100 : 0;
+			const double pValue = MannWhitneyPValue(base.nsPerOp, result.nsPerOp);
+			const bool regressed = changePercent > options.thresholdPercent && pValue < options.alpha;
+			if (regressed)
+				++numRegressions;
+
+			os << std::left << std::setw(64) << result.name << std::right << std::fixed
+				<< std::setw(14) << std::setprecision(0) << baseMedian
+				<< std::setw(14) << currentMedian
+				<< std::setw(9) << std::setprecision(1) << std::showpos << changePercent << std::noshowpos << '%'
+				<< std::setw(10) << std::setprecision(4) << pValue
+				<< (regressed ? "  REGRESSION" : "") << std::defaultfloat << "\n";
+		}
+
+		os << "\n" << numRegressions << " regression(s) beyond " << options.thresholdPercent << "% at alpha " << options.alpha << "\n";
+		return numRegressions;
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "benchmark.h"
+#include <string>
+#include <vector>
+#include <ostream>
+
+// Stores benchmark results as a JSON baseline and gates later runs against it
+namespace Baseline
+{
+	bool Save(const std::string& path, const std::vector<BenchmarkResult>& results);
+
+	// Throws std::runtime_error if the file is missing or malformed
+	std::vector<BenchmarkResult> Load(const std::string& path);
+
+	struct CompareOptions
+	{
+		double thresholdPercent = 5; // Minimum slowdown of the median that counts as a regression
+		double alpha = 0.01;         // Significance level of the one-sided Mann-Whitney U test
+	};
+
+	// Compares each current result against the baseline result of the same name, printing a report. A benchmark
+	// regresses when its median slows down by more than the threshold and the slowdown is statistically significant.
+	// Returns the number of regressions.
+	int Compare(const std::vector<BenchmarkResult>& baseline, const std::vector<BenchmarkResult>& current, const CompareOptions& options, std::ostream& os);
+
+	// One-sided p-value for the hypothesis that samples in b tend to be larger than samples in a
+	double MannWhitneyPValue(const std::vector<double>& a, const std::vector<double>& b);
+}
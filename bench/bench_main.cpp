@@ -0,0 +1,333 @@
+#include "benchmark.h"
+#include "lisp_generator.h"
+#include "baseline.h"
+#include "pipeline.h"
+#include "ast_image.h"
+#include "constexpr_lisp.h"
+#include "variant_match.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <cstring>
+#include <utility>
+
+namespace
+{
+	void PrintUsage(std::ostream& os)
+	{
+		os << "Usage: tinycompiler_bench [options]\n"
+			"  --filter <text>          Only run benchmarks whose name contains text\n"
+			"  --repetitions <n>        Timed repetitions per benchmark (default 15)\n"
+			"  --min-time-ms <ms>       Minimum duration of each repetition (default 20)\n"
+			"  --save-baseline <file>   Save results as a JSON baseline\n"
+			"  --compare <file>         Compare against a baseline; exit with 1 on significant regressions\n"
+			"  --threshold <percent>    Slowdown of the median that counts as a regression (default 5)\n"
+			"  --alpha <p>              Significance level of the Mann-Whitney U test (default 0.01)\n";
+	}
+
+	std::vector<LispGeneratorParams> GetInputConfigurations()
+	{
+		std::vector<LispGeneratorParams> configs;
+		auto Add = [&configs](int formCount, int nestingDepth, int identifierLength, int numberWidth)
+		{
+			LispGeneratorParams params;
+			params.formCount = formCount;
+			params.nestingDepth = nestingDepth;
+			params.identifierLength = identifierLength;
+			params.numberWidth = numberWidth;
+			configs.push_back(params);
+		};
+
+		Add(100, 3, 6, 3);    // Small program
+		Add(10000, 3, 6, 3);  // Large program
+		Add(100, 100, 6, 3);  // Deep nesting
+		Add(1000, 3, 32, 3);  // Long identifiers
+		Add(1000, 3, 6, 9);   // Wide numbers
+		return configs;
+	}
+
+	void RunPipelineBenchmarks(BenchmarkRunner& runner, const LispGeneratorParams& params)
+	{
+		const auto input = GenerateLisp(params);
+		const auto suffix = "/" + DescribeParams(params);
+
+		// Inputs for each phase are produced once up front so each benchmark times exactly one phase
+		const auto tokens = Tokenize(input);
+		const auto lispAst = LispAst::Parse(tokens);
+		const auto cppAst = TransformLispAstToCppAst(lispAst);
+		const auto tokenCount = tokens.size();
+		const auto byteCount = input.size();
+
+		std::vector<Token> tokensOut;
+		runner.Run("Tokenize" + suffix, tokenCount, byteCount, [&] { tokensOut = Tokenize(input); });
+
+		LispAst::NodeUniquePtr lispAstOut;
+		runner.Run("Parse" + suffix, tokenCount, byteCount, [&] { lispAstOut = LispAst::Parse(tokens); });
+
+		CppAst::NodeUniquePtr cppAstOut;
+		runner.Run("Transform" + suffix, tokenCount, byteCount, [&] { cppAstOut = TransformLispAstToCppAst(lispAst); });
+
+		std::string cppCodeOut;
+		runner.Run("GenerateCppCode" + suffix, tokenCount, byteCount, [&] { cppCodeOut = GenerateCppCode(cppAst); });
+
+		runner.Run("EndToEnd" + suffix, tokenCount, byteCount, [&] { cppCodeOut = CompileToCpp(input); });
+
+		// Reuses the context's buffers across iterations, as the server and watch mode do
+		CompilerContext context;
+		runner.Run("EndToEndWarmContext" + suffix, tokenCount, byteCount, [&] { context.CompileToCpp(input); });
+
+		// Cached parses: saving the Lisp AST as an image, then reopening it instead of tokenizing and parsing again
+		std::ostringstream imageStream;
+		runner.Run("SaveLispAstImage" + suffix, tokenCount, byteCount, [&]
+		{
+			imageStream.str(std::string());
+			AstImage::SaveLispAst(lispAst, imageStream);
+		});
+
+		// Views need 8-byte alignment, as a mapped file has
+		const auto imageBytes = imageStream.str();
+		std::vector<uint64_t> image((imageBytes.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+		std::memcpy(image.data(), imageBytes.data(), imageBytes.size());
+		runner.Run("LoadLispAstImage" + suffix, tokenCount, byteCount, [&]
+		{
+			lispAstOut = AstImage::LoadLispAst(AstImage::View(image.data(), imageBytes.size()));
+		});
+	}
+
+	// An embedded snippet evaluated at startup, through the pipeline and with ConstexprLisp at run time. Used in a
+	// constant expression instead, ConstexprLisp costs nothing at run time.
+	void RunSnippetBenchmarks(BenchmarkRunner& runner)
+	{
+		const char snippet[] = "(add 2 (subtract 4 2) (multiply 3 (add 1 1)))";
+		const std::string input = snippet;
+		const auto tokenCount = Tokenize(input).size();
+
+		std::vector<Interpreter::Value> results;
+		runner.Run("EvaluateSnippet/Pipeline", tokenCount, input.size(), [&] { results = EvaluateLisp(input); });
+
+		volatile Interpreter::Value value = 0;
+		runner.Run("EvaluateSnippet/ConstexprLisp", tokenCount, input.size(), [&] { value = ConstexprLisp::Evaluate(snippet); });
+	}
+
+	template <size_t Index>
+	struct Alternative
+	{
+		int value;
+	};
+
+	template <size_t Index>
+	struct AlternativeHandler
+	{
+		int operator()(const Alternative<Index>& alternative) const { return alternative.value + static_cast<int>(Index); }
+	};
+
+	// Matches variants holding the last alternative, the one a linear search over the alternatives would find last, so
+	// the cost per match should be the same whatever the number of alternatives
+	template <size_t... Indices>
+	void RunMatchBenchmark(BenchmarkRunner& runner, std::index_sequence<Indices...>)
+	{
+		using Variant = variant_lib::variant<Alternative<Indices>...>;
+		const size_t alternativeCount = sizeof...(Indices);
+		const std::vector<Variant> variants(4096, Variant{ Alternative<alternativeCount - 1>{ 1 } });
+
+		volatile int sum = 0;
+		runner.Run("Match/" + std::to_string(alternativeCount) + "Alternatives", variants.size(), 0, [&]
+		{
+			int result = 0;
+			for (auto&& variant : variants)
+				result += match(variant, AlternativeHandler<Indices>{}...);
+			sum = result;
+		});
+	}
+
+	void RunMatchBenchmarks(BenchmarkRunner& runner)
+	{
+		RunMatchBenchmark(runner, std::make_index_sequence<2>{});
+		RunMatchBenchmark(runner, std::make_index_sequence<8>{});
+		RunMatchBenchmark(runner, std::make_index_sequence<32>{});
+	}
+
+	Interpreter::Value Sum(void*, const Interpreter::Value* args, size_t numArgs)
+	{
+		uint64_t sum = 0;
+		for (size_t i = 0; i < numArgs; ++i)
+			sum += static_cast<uint64_t>(args[i]);
+		return static_cast<Interpreter::Value>(sum);
+	}
+
+	// Generated programs call random identifiers, so register each of them as a native sum
+	struct NativeCollector : LispAst::Visitor
+	{
+		Interpreter::NativeRegistry natives;
+		size_t callCount = 0;
+
+		virtual void OnVisit(const LispAst::CallExpressionNode& call, const LispAst::Node&, int)
+		{
+			natives.Register(SymbolTable::GetName(call.name), Sum);
+			++callCount;
+		}
+	};
+
+	struct EvaluationThroughput
+	{
+		std::string input;
+		double treeWalkerCallsPerSecond;
+		double bytecodeCallsPerSecond;
+		double jitCallsPerSecond;
+	};
+
+	EvaluationThroughput RunEvaluationBenchmarks(BenchmarkRunner& runner, const LispGeneratorParams& params)
+	{
+		const auto input = GenerateLisp(params);
+		const auto description = DescribeParams(params);
+
+		const auto tokens = Tokenize(input);
+		const auto lispAst = LispAst::Parse(tokens);
+		NativeCollector collector;
+		LispAst::Visit(lispAst, nullptr, collector);
+		const auto program = Bytecode::Compile(lispAst, collector.natives);
+
+		// Zero if the benchmark was filtered out
+		auto CallsPerSecond = [&runner, &collector](const std::string& name)
+		{
+			for (auto&& result : runner.Results())
+			{
+				if (result.name == name && result.Median() > 0)
+					return collector.callCount / result.Median() * 1e9;
+			}
+			return 0.0;
+		};
+
+		const auto treeWalkerName = "EvaluateTreeWalker/" + description;
+		const auto bytecodeName = "ExecuteBytecode/" + description;
+		const auto jitName = "ExecuteJit/" + description;
+
+		std::vector<Interpreter::Value> results;
+		runner.Run(treeWalkerName, tokens.size(), input.size(), [&] { results = Interpreter::Evaluate(lispAst, collector.natives); });
+		runner.Run(bytecodeName, tokens.size(), input.size(), [&] { results = Bytecode::Execute(program); });
+		if (Jit::IsSupported())
+		{
+			const auto jitProgram = Jit::Compile(lispAst, collector.natives);
+			runner.Run(jitName, tokens.size(), input.size(), [&] { results = Jit::Execute(jitProgram); });
+		}
+
+		EvaluationThroughput throughput = { description, CallsPerSecond(treeWalkerName), CallsPerSecond(bytecodeName), CallsPerSecond(jitName) };
+		return throughput;
+	}
+
+	void PrintEvaluationThroughput(const std::vector<EvaluationThroughput>& throughputs, std::ostream& os)
+	{
+		os << '\n' << std::left << std::setw(64) << "Evaluation throughput (Mcalls/s)" << std::right
+			<< std::setw(14) << "Tree-walker" << std::setw(14) << "Bytecode" << std::setw(10) << "Speedup"
+			<< std::setw(14) << "JIT" << std::setw(10) << "Speedup" << '\n';
+		for (auto&& throughput : throughputs)
+		{
+			if (throughput.treeWalkerCallsPerSecond <= 0 || throughput.bytecodeCallsPerSecond <= 0)
+				continue;
+			os << std::left << std::setw(64) << throughput.input << std::right << std::fixed << std::setprecision(1)
+				<< std::setw(14) << throughput.treeWalkerCallsPerSecond / 1e6
+				<< std::setw(14) << throughput.bytecodeCallsPerSecond / 1e6
+				<< std::setw(9) << throughput.bytecodeCallsPerSecond / throughput.treeWalkerCallsPerSecond << 'x';
+			if (throughput.jitCallsPerSecond > 0)
+			{
+				os << std::setw(14) << throughput.jitCallsPerSecond / 1e6
+					<< std::setw(9) << throughput.jitCallsPerSecond / throughput.treeWalkerCallsPerSecond << 'x';
+			}
+			os << std::defaultfloat << '\n';
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	BenchmarkOptions options;
+	Baseline::CompareOptions compareOptions;
+	std::string saveBaselinePath;
+	std::string compareBaselinePath;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (arg == "--filter" && hasValue)
+		{
+			options.filter = argv[++i];
+		}
+		else if (arg == "--repetitions" && hasValue)
+		{
+			options.repetitions = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--min-time-ms" && hasValue)
+		{
+			options.minRepetitionMs = std::atof(argv[++i]);
+		}
+		else if (arg == "--save-baseline" && hasValue)
+		{
+			saveBaselinePath = argv[++i];
+		}
+		else if (arg == "--compare" && hasValue)
+		{
+			compareBaselinePath = argv[++i];
+		}
+		else if (arg == "--threshold" && hasValue)
+		{
+			compareOptions.thresholdPercent = std::atof(argv[++i]);
+		}
+		else if (arg == "--alpha" && hasValue)
+		{
+			compareOptions.alpha = std::atof(argv[++i]);
+		}
+		else
+		{
+			PrintUsage(arg == "--help" ? std::cout : std::cerr);
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+
+#if !defined(NDEBUG)
+	std::cerr << "Warning: benchmarks built with assertions enabled; configure with -DCMAKE_BUILD_TYPE=Release for meaningful numbers\n";
+#endif
+
+	// Load the baseline first so a bad path fails before spending time benchmarking
+	std::vector<BenchmarkResult> baseline;
+	if (!compareBaselinePath.empty())
+	{
+		try
+		{
+			baseline = Baseline::Load(compareBaselinePath);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << '\n';
+			return 1;
+		}
+	}
+
+	BenchmarkRunner runner(options);
+	runner.PrintHeader(std::cout);
+
+	std::vector<EvaluationThroughput> throughputs;
+	for (auto&& params : GetInputConfigurations())
+	{
+		RunPipelineBenchmarks(runner, params);
+		throughputs.push_back(RunEvaluationBenchmarks(runner, params));
+	}
+	RunSnippetBenchmarks(runner);
+	RunMatchBenchmarks(runner);
+	PrintEvaluationThroughput(throughputs, std::cout);
+
+	if (!saveBaselinePath.empty() && !Baseline::Save(saveBaselinePath, runner.Results()))
+	{
+		std::cerr << "Cannot write baseline " << saveBaselinePath << '\n';
+		return 1;
+	}
+
+	if (!compareBaselinePath.empty() && Baseline::Compare(baseline, runner.Results(), compareOptions, std::cout) > 0)
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,95 @@
+#include "benchmark.h"
+#include "stats.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+	double MedianOf(std::vector<double> values)
+	{
+		if (values.empty())
+			return 0;
+		std::sort(values.begin(), values.end());
+		const auto mid = values.size() / 2;
+		return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+	}
+
+	double TimeIterationsNs(size_t iterations, const std::function<void()>& op)
+	{
+		const auto startTime = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < iterations; ++i)
+			op();
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - startTime).count();
+	}
+}
+
+double BenchmarkResult::Median() const
+{
+	return MedianOf(nsPerOp);
+}
+
+double BenchmarkResult::RelativeMad() const
+{
+	const auto median = Median();
+	if (median <= 0)
+		return 0;
+	std::vector<double> deviations;
+	for (auto sample : nsPerOp)
+		deviations.push_back(std::abs(sample - median));
+	return MedianOf(deviations) / median;
+}
+
+void BenchmarkRunner::Run(const std::string& name, size_t tokensPerOp, size_t bytesPerOp, const std::function<void()>& op)
+{
+	if (!m_options.filter.empty() && name.find(m_options.filter) == std::string::npos)
+		return;
+
+	BenchmarkResult result;
+	result.name = name;
+	result.tokensPerOp = static_cast<double>(tokensPerOp);
+	result.bytesPerOp = static_cast<double>(bytesPerOp);
+
+	// Warm up caches and the allocator, measuring allocations on a warm iteration
+	op();
+	const auto allocationsBefore = Stats::GetAllocationCounters().count;
+	const auto firstNs = TimeIterationsNs(1, op);
+	result.allocationsPerOp = static_cast<double>(Stats::GetAllocationCounters().count - allocationsBefore);
+
+	// Calibrate the iteration count so each repetition is long enough to swamp timer resolution
+	const auto minRepetitionNs = m_options.minRepetitionMs * 1e6;
+	size_t iterations = 1;
+	double elapsedNs = firstNs;
+	while (elapsedNs < minRepetitionNs)
+	{
+		iterations = elapsedNs > 0 ? std::max(iterations * 2, static_cast<size_t>(iterations * minRepetitionNs / elapsedNs * 1.1)) : iterations * 2;
+		elapsedNs = TimeIterationsNs(iterations, op);
+	}
+
+	for (int i = 0; i < m_options.repetitions; ++i)
+		result.nsPerOp.push_back(TimeIterationsNs(iterations, op) / iterations);
+
+	PrintResult(result, std::cout);
+	m_results.push_back(std::move(result));
+}
+
+void BenchmarkRunner::PrintHeader(std::ostream& os) const
+{
+	os << std::left << std::setw(64) << "Benchmark" << std::right
+		<< std::setw(14) << "ns/op" << std::setw(9) << "+/-"
+		<< std::setw(11) << "ns/token" << std::setw(10) << "MB/s" << std::setw(12) << "allocs/op" << '\n';
+}
+
+void BenchmarkRunner::PrintResult(const BenchmarkResult& result, std::ostream& os) const
+{
+	const auto median = result.Median();
+	os << std::left << std::setw(64) << result.name << std::right << std::fixed
+		<< std::setw(14) << std::setprecision(0) << median
+		<< std::setw(8) << std::setprecision(1) << result.RelativeMad() * 100 << '%'
+		<< std::setw(11) << std::setprecision(2) << (result.tokensPerOp > 0 ? median / result.tokensPerOp : 0)
+		<< std::setw(10) << std::setprecision(1) << (median > 0 ? result.bytesPerOp / median * 1e3 : 0)
+		<< std::setw(12) << std::setprecision(0) << result.allocationsPerOp
+		<< std::defaultfloat << std::endl;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <ostream>
+
+struct BenchmarkOptions
+{
+	int repetitions = 15;
+	double minRepetitionMs = 20; // Each repetition runs enough iterations to take at least this long
+	std::string filter;          // Only run benchmarks whose name contains this
+};
+
+struct BenchmarkResult
+{
+	std::string name;
+	std::vector<double> nsPerOp; // One sample per repetition
+	double tokensPerOp = 0;
+	double bytesPerOp = 0;
+	double allocationsPerOp = 0;
+
+	double Median() const;
+	// Median absolute deviation relative to the median, a spread measure that ignores the odd descheduled repetition
+	double RelativeMad() const;
+};
+
+class BenchmarkRunner
+{
+public:
+	explicit BenchmarkRunner(const BenchmarkOptions& options) : m_options(options) {}
+
+	// Runs op repeatedly and records a result. tokensPerOp and bytesPerOp describe the input processed by one call
+	// of op, and are used to report per-token cost and throughput.
+	void Run(const std::string& name, size_t tokensPerOp, size_t bytesPerOp, const std::function<void()>& op);
+
+	const std::vector<BenchmarkResult>& Results() const { return m_results; }
+
+	void PrintHeader(std::ostream& os) const;
+	void PrintResult(const BenchmarkResult& result, std::ostream& os) const;
+
+private:
+	BenchmarkOptions m_options;
+	std::vector<BenchmarkResult> m_results;
+};
@@ -0,0 +1,41 @@
+#include "pipeline.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <stdexcept>
+
+// libFuzzer entry point for the whole pipeline. The first byte selects the options and backend, so the fuzzer
+// explores the optimization passes and evaluators as well as code generation; the rest is the Lisp source. Errors
+// reported by the compiler throw and are expected; crashes, sanitizer reports, and inputs that blow the time or memory
+// limit are findings.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	if (size == 0)
+		return 0;
+
+	const uint8_t flags = data[0];
+	CompileOptions options;
+	options.parse.hashCons = (flags & 1) != 0;
+	options.foldConstants = (flags & 2) != 0;
+	if (flags & 4)
+	{
+		options.eliminateCommonSubexpressions = true;
+		for (auto&& name : ConstantFolding::GetKnownBuiltinNames())
+			options.cse.AddPureFunction(name);
+	}
+	options.codeGen.constexprBuiltins = (flags & 8) != 0;
+	const Backend backends[] = { Backend::Cpp, Backend::Interpreter, Backend::Bytecode, Backend::Jit };
+	options.backend = backends[(flags >> 4) & 3];
+
+	// Reused across inputs, as the server and -j workers do
+	static CompilerContext context;
+
+	try
+	{
+		context.RunPipeline(std::string(reinterpret_cast<const char*>(data + 1), size - 1), options);
+	}
+	catch (const std::exception&)
+	{
+	}
+	return 0;
+}
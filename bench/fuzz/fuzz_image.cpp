@@ -0,0 +1,131 @@
+#include "ast_image.h"
+#include "compiler.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+	// Copies an image into 8-byte aligned storage, as View requires
+	std::vector<uint64_t> Align(const std::string& image)
+	{
+		std::vector<uint64_t> buffer((image.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+		std::memcpy(buffer.data(), image.data(), image.size());
+		return buffer;
+	}
+
+	// Runs a loaded tree through the passes that follow loading, which trust it as much as a parsed one
+	void GenerateFromCppAst(const CppAst::NodeUniquePtr& cppAst)
+	{
+		GenerateCppCode(cppAst);
+	}
+
+	void GenerateFromLispAst(const LispAst::NodeUniquePtr& lispAst)
+	{
+		GenerateCppCode(TransformLispAstToCppAst(lispAst));
+	}
+
+	template <typename SaveFunc, typename LoadFunc, typename GenerateFunc>
+	void CheckImage(const std::string& image, SaveFunc Save, LoadFunc Load, GenerateFunc Generate)
+	{
+		auto buffer = Align(image);
+
+		// Saving what was loaded must give back the same bytes, references to shared calls included
+		auto loaded = Load(AstImage::View(buffer.data(), image.size()));
+		std::ostringstream reloaded;
+		Save(loaded, reloaded);
+		if (reloaded.str() != image)
+			std::abort();
+		Generate(loaded);
+
+		// Every record lies past the header, so an image cut short must be rejected before anything is built
+		for (size_t size : { size_t(0), image.size() / 2, image.size() - 1 })
+		{
+			try
+			{
+				Load(AstImage::View(buffer.data(), size));
+				std::abort();
+			}
+			catch (const std::runtime_error&)
+			{
+			}
+		}
+
+		// A corrupt byte may go unnoticed when it only changes a value, but must never take a reader out of the image,
+		// nor give the passes a tree they can't handle
+		auto bytes = reinterpret_cast<char*>(buffer.data());
+		for (size_t offset = 0; offset < image.size(); offset += 1 + image.size() / 16)
+		{
+			bytes[offset] ^= 0x5a;
+			try
+			{
+				Generate(Load(AstImage::View(buffer.data(), image.size())));
+			}
+			catch (const std::runtime_error&)
+			{
+			}
+			bytes[offset] ^= 0x5a;
+		}
+
+		// Records are multiples of 8 bytes, so swapping two words reorders parameters or moves a node
+		for (size_t word = 0; word + 1 < buffer.size(); word += 1 + buffer.size() / 16)
+		{
+			std::swap(buffer[word], buffer[word + 1]);
+			try
+			{
+				Generate(Load(AstImage::View(buffer.data(), image.size())));
+			}
+			catch (const std::runtime_error&)
+			{
+			}
+			std::swap(buffer[word], buffer[word + 1]);
+		}
+	}
+}
+
+// libFuzzer entry point: parses the input as Lisp source with and without hash-consing, and checks that the Lisp and
+// C++ ASTs survive a round trip through an image unchanged, and that truncated or corrupted images are rejected
+// without crashing, whether by the loader or by the passes run on what it loads. Syntax errors throw and are expected.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	static std::vector<Token> tokens;
+
+	try
+	{
+		Tokenize(std::string(reinterpret_cast<const char*>(data), size), tokens);
+	}
+	catch (const std::exception&)
+	{
+		return 0;
+	}
+
+	for (bool hashCons : { false, true })
+	{
+		LispAst::ParseOptions options;
+		options.hashCons = hashCons;
+		LispAst::NodeUniquePtr lispAst;
+		try
+		{
+			lispAst = LispAst::Parse(tokens, options);
+		}
+		catch (const std::exception&)
+		{
+			continue;
+		}
+
+		std::ostringstream lispImage;
+		AstImage::SaveLispAst(lispAst, lispImage);
+		CheckImage(lispImage.str(), AstImage::SaveLispAst, AstImage::LoadLispAst, GenerateFromLispAst);
+
+		std::ostringstream cppImage;
+		AstImage::SaveCppAst(TransformLispAstToCppAst(lispAst), cppImage);
+		CheckImage(cppImage.str(), AstImage::SaveCppAst, AstImage::LoadCppAst, GenerateFromCppAst);
+	}
+	return 0;
+}
@@ -0,0 +1,36 @@
+#include "compiler.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// libFuzzer entry point: parses the input as Lisp source into a tree, then into a DAG with hash-consing. Syntax errors
+// throw and are expected; crashes, sanitizer reports, and inputs that blow the time or memory limit are findings.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	static std::vector<Token> tokens;
+
+	try
+	{
+		Tokenize(std::string(reinterpret_cast<const char*>(data), size), tokens);
+	}
+	catch (const std::exception&)
+	{
+		return 0;
+	}
+
+	for (bool hashCons : { false, true })
+	{
+		LispAst::ParseOptions options;
+		options.hashCons = hashCons;
+		try
+		{
+			LispAst::Parse(tokens, options);
+		}
+		catch (const std::exception&)
+		{
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,23 @@
+#include "compiler.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// libFuzzer entry point: tokenizes the input as Lisp source. Rejected characters throw, as they do for the compiler;
+// anything else that goes wrong (a crash, a sanitizer report, or blowing the time or memory limit) is a finding.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	// Reused across inputs, as CompilerContext does
+	static std::vector<Token> tokens;
+
+	try
+	{
+		Tokenize(std::string(reinterpret_cast<const char*>(data), size), tokens);
+	}
+	catch (const std::exception&)
+	{
+	}
+	return 0;
+}
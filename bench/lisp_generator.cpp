@@ -0,0 +1,77 @@
+#include "lisp_generator.h"
+#include <random>
+#include <sstream>
+#include <algorithm>
+
+namespace
+{
+	class Generator
+	{
+	public:
+		Generator(const LispGeneratorParams& params) : m_params(params), m_random(params.seed) {}
+
+		std::string Generate()
+		{
+			for (int i = 0; i < m_params.formCount; ++i)
+			{
+				AppendCall(m_params.nestingDepth);
+				m_result += '\n';
+			}
+			return std::move(m_result);
+		}
+
+	private:
+		void AppendCall(int depth)
+		{
+			m_result += '(';
+			AppendIdentifier();
+			for (int i = 0; i < m_params.arity; ++i)
+			{
+				m_result += ' ';
+				if (i == 0 && depth > 1)
+					AppendCall(depth - 1);
+				else
+					AppendNumber();
+			}
+			m_result += ')';
+		}
+
+		void AppendIdentifier()
+		{
+			std::uniform_int_distribution<int> letter('a', 'z');
+			for (int i = 0; i < m_params.identifierLength; ++i)
+				m_result += static_cast<char>(letter(m_random));
+		}
+
+		void AppendNumber()
+		{
+			// No leading zeros, and the width is capped so literals always fit an int
+			std::uniform_int_distribution<int> digit('0', '9');
+			std::uniform_int_distribution<int> firstDigit('1', '9');
+			const int width = std::max(1, std::min(m_params.numberWidth, 9));
+			m_result += static_cast<char>(firstDigit(m_random));
+			for (int i = 1; i < width; ++i)
+				m_result += static_cast<char>(digit(m_random));
+		}
+
+		const LispGeneratorParams& m_params;
+		std::mt19937 m_random;
+		std::string m_result;
+	};
+}
+
+std::string GenerateLisp(const LispGeneratorParams& params)
+{
+	return Generator(params).Generate();
+}
+
+std::string DescribeParams(const LispGeneratorParams& params)
+{
+	std::ostringstream os;
+	os << "forms=" << params.formCount
+		<< ",depth=" << params.nestingDepth
+		<< ",arity=" << params.arity
+		<< ",ident=" << params.identifierLength
+		<< ",width=" << params.numberWidth;
+	return os.str();
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// Synthetic Lisp input for benchmarks. Every top-level form is a call whose first parameter is a nested call (down to
+// nestingDepth levels) followed by number literals, e.g. with depth 2 and arity 3: (abc (def 12 34) 56 78)
+struct LispGeneratorParams
+{
+	int formCount = 1000;
+	int nestingDepth = 3;
+	int arity = 2;
+	int identifierLength = 6;
+	int numberWidth = 3;
+	uint32_t seed = 1;
+};
+
+std::string GenerateLisp(const LispGeneratorParams& params);
+
+// Short human-readable description of params, used in benchmark names
+std::string DescribeParams(const LispGeneratorParams& params);
@@ -0,0 +1,42 @@
+#include "stats.h"
+#include <cstdlib>
+#include <new>
+
+// In a file of their own, so their malloc and free calls are never inlined next to new-expressions elsewhere, which
+// GCC reports as mismatched (-Wmismatched-new-delete)
+
+namespace
+{
+	// Per thread, so that phases compiled concurrently on worker threads are measured independently
+	thread_local size_t t_bytesAllocated = 0;
+	thread_local size_t t_allocationCount = 0;
+}
+
+// Counting replacements for the global allocation functions. The array and nothrow forms forward to these.
+void* operator new(std::size_t size)
+{
+	t_bytesAllocated += size;
+	++t_allocationCount;
+	if (auto p = std::malloc(size == 0 ? 1 : size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+namespace Stats
+{
+	// Defined here, so linking anything that reads the counters also links the replacements above
+	AllocationCounters GetAllocationCounters()
+	{
+		return AllocationCounters{ t_bytesAllocated, t_allocationCount };
+	}
+}
@@ -0,0 +1,645 @@
+#include "ast_image.h"
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <initializer_list>
+#include <unordered_map>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace AstImage
+{
+	static_assert(sizeof(NodeRecord) == 16, "NodeRecord is part of the image format");
+	static_assert(sizeof(ParamRecord) == 8, "ParamRecord is part of the image format");
+	static_assert(sizeof(StringRecord) == 8, "StringRecord is part of the image format");
+	static_assert(sizeof(Header) == 48, "Header is part of the image format");
+
+	namespace
+	{
+		const char Magic[4] = { 'T', 'C', 'A', 'I' };
+
+		Symbol GetCallName(const LispAst::CallExpressionNode& call) { return call.name; }
+		Symbol GetCallName(const CppAst::CallExpressionNode& call) { return call.callee->name; }
+
+		void ThrowCorrupt()
+		{
+			throw std::runtime_error("Corrupt AST image");
+		}
+
+		uint32_t ToUint32(size_t value)
+		{
+			if (value > std::numeric_limits<uint32_t>::max())
+				throw std::runtime_error("AST too large for an image");
+			return static_cast<uint32_t>(value);
+		}
+
+		class Writer
+		{
+		public:
+			uint32_t AddNode(NodeType type, uint32_t a, uint32_t b = 0, uint32_t c = 0, uint8_t flags = 0)
+			{
+				m_nodes.push_back(NodeRecord{ type, flags, 0, a, b, c });
+				return ToUint32(m_nodes.size() - 1);
+			}
+
+			uint32_t AddString(const std::string& s)
+			{
+				m_strings.push_back(StringRecord{ ToUint32(m_stringData.size()), ToUint32(s.size()) });
+				m_stringData.append(s);
+				m_stringData.push_back('\0');
+				return ToUint32(m_strings.size() - 1);
+			}
+
+			uint32_t AddSymbol(Symbol symbol)
+			{
+				auto iter = m_symbolStrings.find(symbol);
+				if (iter == m_symbolStrings.end())
+					iter = m_symbolStrings.emplace(symbol, AddString(SymbolTable::GetName(symbol))).first;
+				return iter->second;
+			}
+
+			// Appends the records of params to the parameter array, returning the index of the first one
+			uint32_t AddParams(const ParamRecord* params, size_t count)
+			{
+				const auto first = ToUint32(m_params.size());
+				m_params.insert(m_params.end(), params, params + count);
+				return first;
+			}
+
+			// Writes the calls under root, and root itself, children first. Calls are walked from an explicit stack, so
+			// nesting depth is only limited by memory. WriteLeaf writes any other node type.
+			template <typename CallNode, typename RefNode, typename WriteLeafFunc>
+			uint32_t AddExpression(const CommonAst::Node* root, WriteLeafFunc WriteLeaf)
+			{
+				struct Frame
+				{
+					const CallNode* call;
+					size_t nextParam;
+					size_t pendingBase; // Where the call's parameter records start in m_pendingParams
+				};
+
+				auto AddLeaf = [&](const CommonAst::Node* node)
+				{
+					if (auto ref = CommonAst::AsNodePtr<const RefNode*>(node))
+					{
+						auto iter = m_sharedCalls.find(ref->target);
+						if (iter == m_sharedCalls.end())
+							throw std::logic_error("Reference to a call that doesn't precede it");
+						return AddNode(NodeType::CallExpressionRef, iter->second);
+					}
+					return WriteLeaf(node);
+				};
+
+				auto rootCall = CommonAst::AsNodePtr<const CallNode*>(root);
+				if (!rootCall)
+					return AddLeaf(root);
+
+				std::vector<Frame> frames{ Frame{ rootCall, 0, m_pendingParams.size() } };
+				while (true)
+				{
+					auto& frame = frames.back();
+					if (frame.nextParam < frame.call->params.size())
+					{
+						auto&& param = frame.call->params[frame.nextParam++];
+						if (param.IsLiteral())
+							m_pendingParams.push_back(ParamRecord{ 1, static_cast<uint32_t>(param.GetLiteral()) });
+						else if (auto call = CommonAst::AsNodePtr<const CallNode*>(param))
+							frames.push_back(Frame{ call, 0, m_pendingParams.size() });
+						else
+							m_pendingParams.push_back(ParamRecord{ 0, AddLeaf(param.GetNode()) });
+						continue;
+					}
+
+					auto call = frame.call;
+					const auto pendingBase = frame.pendingBase;
+					frames.pop_back();
+
+					const auto firstParam = AddParams(m_pendingParams.data() + pendingBase, m_pendingParams.size() - pendingBase);
+					m_pendingParams.resize(pendingBase);
+					const auto index = AddNode(NodeType::CallExpression, AddSymbol(GetCallName(*call)), firstParam,
+						ToUint32(call->params.size()), call->shared ? SharedFlag : 0);
+					if (call->shared)
+						m_sharedCalls.emplace(call, index);
+
+					if (frames.empty())
+						return index;
+					m_pendingParams.push_back(ParamRecord{ 0, index });
+				}
+			}
+
+			void Write(AstKind kind, uint32_t root, std::ostream& os) const
+			{
+				Header header = {};
+				std::memcpy(header.magic, Magic, sizeof(Magic));
+				header.byteOrder = ByteOrderMark;
+				header.version = Version;
+				header.kind = kind;
+				header.root = root;
+
+				// Records are multiples of 8 bytes, as is the header, so every section is 8-byte aligned
+				size_t offset = sizeof(Header);
+				auto PlaceSection = [&offset](Section& section, size_t count, size_t recordSize)
+				{
+					section.offset = ToUint32(offset);
+					section.count = ToUint32(count);
+					offset += count * recordSize;
+				};
+				PlaceSection(header.nodes, m_nodes.size(), sizeof(NodeRecord));
+				PlaceSection(header.params, m_params.size(), sizeof(ParamRecord));
+				PlaceSection(header.strings, m_strings.size(), sizeof(StringRecord));
+				const auto stringDataOffset = offset;
+				header.size = ToUint32(stringDataOffset + m_stringData.size());
+
+				os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				os.write(reinterpret_cast<const char*>(m_nodes.data()), m_nodes.size() * sizeof(NodeRecord));
+				os.write(reinterpret_cast<const char*>(m_params.data()), m_params.size() * sizeof(ParamRecord));
+				for (auto string : m_strings)
+				{
+					string.offset = ToUint32(stringDataOffset + string.offset);
+					os.write(reinterpret_cast<const char*>(&string), sizeof(string));
+				}
+				os.write(m_stringData.data(), m_stringData.size());
+			}
+
+		private:
+			std::vector<NodeRecord> m_nodes;
+			std::vector<ParamRecord> m_params;
+			std::vector<StringRecord> m_strings; // Offsets into m_stringData until written
+			std::string m_stringData;
+			std::unordered_map<Symbol, uint32_t> m_symbolStrings;
+			std::unordered_map<const CommonAst::Node*, uint32_t> m_sharedCalls;
+			std::vector<ParamRecord> m_pendingParams; // Of the calls being written, innermost last
+		};
+
+		// Nodes are created in record order and owned here until their parent takes them. Since children precede
+		// their parent, one pass builds the whole tree. The records must be in post-order, as the writer leaves them, so
+		// a call that precedes a reference to it has been walked completely by every pass before the reference is
+		// reached.
+		class Loader
+		{
+		public:
+			Loader(const View& view, AstKind kind)
+				: m_view(view)
+				, m_nodes(view.GetNodeCount())
+				, m_built(view.GetNodeCount())
+				, m_subtreeStarts(view.GetNodeCount())
+				, m_symbols(view.GetStringCount(), SymbolTable::InvalidSymbol)
+			{
+				if (view.GetKind() != kind)
+					throw std::runtime_error(kind == AstKind::Lisp ? "AST image doesn't hold a Lisp AST" : "AST image doesn't hold a C++ AST");
+				if (view.GetNodeCount() == 0 || view.GetRoot() != view.GetNodeCount() - 1
+					|| view.GetNode(view.GetRoot()).type != NodeType::Program)
+					ThrowCorrupt();
+			}
+
+			template <typename BuildNodeFunc>
+			CommonAst::NodeUniquePtr Load(BuildNodeFunc BuildNode)
+			{
+				for (uint32_t i = 0; i < m_view.GetNodeCount(); ++i)
+				{
+					m_index = i;
+					m_firstChild = true;
+					m_nodes[i] = BuildNode(m_view.GetNode(i));
+					m_built[i] = m_nodes[i].get();
+
+					// The last child's subtree ends right before its parent
+					if (m_firstChild)
+						m_subtreeStarts[i] = i;
+					else if (m_lastChild != i - 1)
+						ThrowCorrupt();
+				}
+
+				// Every node but the root must have been taken by its parent, or a reference could outlive its target
+				if (m_taken != m_nodes.size() - 1)
+					ThrowCorrupt();
+				return std::move(m_nodes.back());
+			}
+
+			// Moves out a child of the node being built, which must precede it, be one of the types the passes expect
+			// there, and not already belong to another node. Each child's subtree must start right after the previous
+			// child, so the records are in post-order.
+			CommonAst::NodeUniquePtr TakeNode(uint32_t index, std::initializer_list<NodeType> types)
+			{
+				if (index >= m_index || !m_nodes[index]
+					|| std::find(types.begin(), types.end(), m_view.GetNode(index).type) == types.end())
+					ThrowCorrupt();
+				if (m_firstChild)
+					m_subtreeStarts[m_index] = m_subtreeStarts[index];
+				else if (m_subtreeStarts[index] != m_lastChild + 1)
+					ThrowCorrupt();
+				m_firstChild = false;
+				m_lastChild = index;
+				++m_taken;
+				return std::move(m_nodes[index]);
+			}
+
+			// References don't own their target, which stays where its parent put it
+			template <typename CallNode>
+			const CallNode* GetTarget(uint32_t index) const
+			{
+				if (index >= m_index || !(m_view.GetNode(index).flags & SharedFlag))
+					ThrowCorrupt();
+				auto call = CommonAst::AsNodePtr<const CallNode*>(m_built[index]);
+				if (!call)
+					ThrowCorrupt();
+				return call;
+			}
+
+			Symbol GetSymbol(uint32_t stringIndex)
+			{
+				if (stringIndex >= m_symbols.size())
+					ThrowCorrupt();
+				auto& symbol = m_symbols[stringIndex];
+				if (symbol == SymbolTable::InvalidSymbol)
+					symbol = SymbolTable::Intern(m_view.GetString(stringIndex), m_view.GetStringSize(stringIndex));
+				return symbol;
+			}
+
+			std::string GetString(uint32_t stringIndex) const
+			{
+				return std::string(m_view.GetString(stringIndex), m_view.GetStringSize(stringIndex));
+			}
+
+			void LoadParams(const NodeRecord& record, CommonAst::ParamList& params, std::initializer_list<NodeType> types)
+			{
+				auto paramRecords = m_view.GetParams(record);
+				params.reserve(record.c);
+				for (uint32_t i = 0; i < record.c; ++i)
+				{
+					auto&& param = paramRecords[i];
+					if (param.isLiteral)
+						params.push_back(CommonAst::Param::Literal(static_cast<int>(param.value)));
+					else
+						params.push_back(CommonAst::Param(TakeNode(param.value, types)));
+				}
+			}
+
+			void LoadBody(const NodeRecord& record, std::vector<CommonAst::NodeUniquePtr>& body, std::initializer_list<NodeType> types)
+			{
+				auto paramRecords = m_view.GetParams(record);
+				body.reserve(record.c);
+				for (uint32_t i = 0; i < record.c; ++i)
+				{
+					if (paramRecords[i].isLiteral)
+						ThrowCorrupt();
+					body.push_back(TakeNode(paramRecords[i].value, types));
+				}
+			}
+
+		private:
+			const View& m_view;
+			std::vector<CommonAst::NodeUniquePtr> m_nodes;
+			std::vector<const CommonAst::Node*> m_built; // Still valid once taken by their parent
+			std::vector<uint32_t> m_subtreeStarts; // The first record of each node's subtree
+			std::vector<Symbol> m_symbols; // Interned on first use, by string index
+			uint32_t m_index = 0; // Of the node being built
+			bool m_firstChild = true; // No child of the node being built has been taken yet
+			uint32_t m_lastChild = 0; // The child of the node being built taken last
+			size_t m_taken = 0;
+		};
+	}
+
+	void SaveLispAst(const LispAst::NodeUniquePtr& lispAst, std::ostream& os)
+	{
+		using namespace LispAst;
+
+		auto program = AsNodePtr<const ProgramNode*>(lispAst);
+		assert(program);
+
+		Writer writer;
+		std::vector<ParamRecord> body;
+		for (auto&& bodyNode : program->body)
+		{
+			const auto index = writer.AddExpression<CallExpressionNode, CallExpressionRefNode>(bodyNode.get(), [&](const Node* node)
+			{
+				auto literal = AsNodePtr<const NumberLiteralNode*>(node);
+				assert(literal);
+				return writer.AddNode(NodeType::NumberLiteral, static_cast<uint32_t>(literal->value));
+			});
+			body.push_back(ParamRecord{ 0, index });
+		}
+
+		const auto root = writer.AddNode(NodeType::Program, writer.AddString(program->name),
+			writer.AddParams(body.data(), body.size()), ToUint32(body.size()));
+		writer.Write(AstKind::Lisp, root, os);
+	}
+
+	void SaveCppAst(const CppAst::NodeUniquePtr& cppAst, std::ostream& os)
+	{
+		using namespace CppAst;
+
+		auto program = AsNodePtr<const ProgramNode*>(cppAst);
+		assert(program);
+
+		Writer writer;
+		auto AddExpression = [&writer](const NodeUniquePtr& expression)
+		{
+			return writer.AddExpression<CallExpressionNode, CallExpressionRefNode>(expression.get(), [&writer](const Node* node)
+			{
+				if (auto identifier = AsNodePtr<const IdentifierNode*>(node))
+					return writer.AddNode(NodeType::Identifier, writer.AddSymbol(identifier->name));
+				auto literal = AsNodePtr<const NumberLiteralNode*>(node);
+				assert(literal);
+				return writer.AddNode(NodeType::NumberLiteral, static_cast<uint32_t>(literal->value));
+			});
+		};
+
+		std::vector<ParamRecord> body;
+		for (auto&& statement : program->body)
+		{
+			uint32_t index;
+			if (auto expressionStatement = AsNodePtr<const ExpressionStatementNode*>(statement))
+			{
+				index = writer.AddNode(NodeType::ExpressionStatement, AddExpression(expressionStatement->expression));
+			}
+			else
+			{
+				auto declaration = AsNodePtr<const VariableDeclarationNode*>(statement);
+				assert(declaration);
+				const auto initializer = AddExpression(declaration->initializer);
+				index = writer.AddNode(NodeType::VariableDeclaration, writer.AddSymbol(declaration->name->name), initializer);
+			}
+			body.push_back(ParamRecord{ 0, index });
+		}
+
+		const auto root = writer.AddNode(NodeType::Program, writer.AddString(program->name),
+			writer.AddParams(body.data(), body.size()), ToUint32(body.size()));
+		writer.Write(AstKind::Cpp, root, os);
+	}
+
+	View::View(const void* data, size_t size)
+		: m_data(static_cast<const char*>(data))
+		, m_header(static_cast<const Header*>(data))
+	{
+		if (size < sizeof(Header) || std::memcmp(m_header->magic, Magic, sizeof(Magic)) != 0)
+			throw std::runtime_error("Not an AST image");
+		if (m_header->byteOrder != ByteOrderMark)
+			throw std::runtime_error("AST image was written with another byte order");
+		if (m_header->version != Version)
+			throw std::runtime_error("Unsupported AST image version " + std::to_string(m_header->version));
+		if (reinterpret_cast<uintptr_t>(data) % alignof(uint64_t) != 0)
+			throw std::logic_error("AST image must be 8-byte aligned");
+		if (m_header->size > size || (m_header->kind != AstKind::Lisp && m_header->kind != AstKind::Cpp))
+			ThrowCorrupt();
+
+		auto CheckSection = [this](const Section& section, size_t recordSize)
+		{
+			const uint64_t end = section.offset + static_cast<uint64_t>(section.count) * recordSize;
+			if (section.offset < sizeof(Header) || section.offset % alignof(uint64_t) != 0 || end > m_header->size)
+				ThrowCorrupt();
+			return m_data + section.offset;
+		};
+		m_nodes = reinterpret_cast<const NodeRecord*>(CheckSection(m_header->nodes, sizeof(NodeRecord)));
+		m_params = reinterpret_cast<const ParamRecord*>(CheckSection(m_header->params, sizeof(ParamRecord)));
+		m_strings = reinterpret_cast<const StringRecord*>(CheckSection(m_header->strings, sizeof(StringRecord)));
+	}
+
+	const NodeRecord& View::GetNode(uint32_t index) const
+	{
+		if (index >= m_header->nodes.count)
+			ThrowCorrupt();
+		return m_nodes[index];
+	}
+
+	const ParamRecord* View::GetParams(const NodeRecord& node) const
+	{
+		if ((node.type != NodeType::Program && node.type != NodeType::CallExpression)
+			|| static_cast<uint64_t>(node.b) + node.c > m_header->params.count)
+			ThrowCorrupt();
+		return m_params + node.b;
+	}
+
+	const char* View::GetString(uint32_t index) const
+	{
+		return m_data + GetStringRecord(index).offset;
+	}
+
+	uint32_t View::GetStringSize(uint32_t index) const
+	{
+		return GetStringRecord(index).size;
+	}
+
+	const StringRecord& View::GetStringRecord(uint32_t index) const
+	{
+		if (index >= m_header->strings.count)
+			ThrowCorrupt();
+		auto&& string = m_strings[index];
+		const uint64_t end = static_cast<uint64_t>(string.offset) + string.size;
+		if (end >= m_header->size || m_data[end] != '\0')
+			ThrowCorrupt();
+		return string;
+	}
+
+	MappedFile::MappedFile(const std::string& path)
+		: m_mapping(path)
+		, m_view(m_mapping.data, m_mapping.size)
+	{
+	}
+
+#if defined(__linux__)
+
+	MappedFile::Mapping::Mapping(const std::string& path)
+	{
+		const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			throw std::runtime_error("Cannot open " + path);
+
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			close(fd);
+			throw std::runtime_error("Cannot read " + path);
+		}
+
+		size = static_cast<size_t>(st.st_size);
+		if (size > 0)
+		{
+			void* memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+			if (memory == MAP_FAILED)
+			{
+				close(fd);
+				throw std::runtime_error("Cannot map " + path);
+			}
+			data = memory;
+			mapped = true;
+		}
+		close(fd);
+	}
+
+	MappedFile::Mapping::~Mapping()
+	{
+		if (mapped)
+			munmap(const_cast<void*>(data), size);
+	}
+
+#else
+
+	MappedFile::Mapping::Mapping(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file)
+			throw std::runtime_error("Cannot open " + path);
+
+		size = static_cast<size_t>(file.tellg());
+		buffer.resize((size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+		file.seekg(0);
+		if (!file.read(reinterpret_cast<char*>(buffer.data()), size))
+			throw std::runtime_error("Cannot read " + path);
+		data = buffer.data();
+	}
+
+	MappedFile::Mapping::~Mapping()
+	{
+	}
+
+#endif
+
+	LispAst::NodeUniquePtr LoadLispAst(const View& view)
+	{
+		using namespace LispAst;
+
+		Loader loader(view, AstKind::Lisp);
+		return loader.Load([&loader](const NodeRecord& record) -> NodeUniquePtr
+		{
+			switch (record.type)
+			{
+			case NodeType::Program:
+			{
+				auto program = std::make_unique<ProgramNode>();
+				program->name = loader.GetString(record.a);
+				loader.LoadBody(record, program->body, { NodeType::CallExpression, NodeType::NumberLiteral });
+				return std::move(program);
+			}
+			case NodeType::CallExpression:
+			{
+				auto call = std::make_unique<CallExpressionNode>();
+				call->name = loader.GetSymbol(record.a);
+				call->shared = (record.flags & SharedFlag) != 0;
+				loader.LoadParams(record, call->params, { NodeType::CallExpression, NodeType::CallExpressionRef });
+				return std::move(call);
+			}
+			case NodeType::NumberLiteral:
+				return std::make_unique<NumberLiteralNode>(static_cast<int>(record.a));
+			case NodeType::CallExpressionRef:
+				return std::make_unique<CallExpressionRefNode>(loader.GetTarget<CallExpressionNode>(record.a));
+			default:
+				ThrowCorrupt();
+				return nullptr;
+			}
+		});
+	}
+
+	CppAst::NodeUniquePtr LoadCppAst(const View& view)
+	{
+		using namespace CppAst;
+
+		const auto expressionTypes = { NodeType::CallExpression, NodeType::CallExpressionRef, NodeType::Identifier, NodeType::NumberLiteral };
+		Loader loader(view, AstKind::Cpp);
+		return loader.Load([&loader, &expressionTypes](const NodeRecord& record) -> NodeUniquePtr
+		{
+			switch (record.type)
+			{
+			case NodeType::Program:
+			{
+				auto program = std::make_unique<ProgramNode>();
+				program->name = loader.GetString(record.a);
+				loader.LoadBody(record, program->body, { NodeType::ExpressionStatement, NodeType::VariableDeclaration });
+				return std::move(program);
+			}
+			case NodeType::CallExpression:
+			{
+				auto call = std::make_unique<CallExpressionNode>();
+				call->callee = std::make_unique<IdentifierNode>(loader.GetSymbol(record.a));
+				call->shared = (record.flags & SharedFlag) != 0;
+				loader.LoadParams(record, call->params, expressionTypes);
+				return std::move(call);
+			}
+			case NodeType::NumberLiteral:
+				return std::make_unique<NumberLiteralNode>(static_cast<int>(record.a));
+			case NodeType::CallExpressionRef:
+				return std::make_unique<CallExpressionRefNode>(loader.GetTarget<CallExpressionNode>(record.a));
+			case NodeType::Identifier:
+				return std::make_unique<IdentifierNode>(loader.GetSymbol(record.a));
+			case NodeType::ExpressionStatement:
+			{
+				auto statement = std::make_unique<ExpressionStatementNode>();
+				statement->expression = loader.TakeNode(record.a, expressionTypes);
+				return std::move(statement);
+			}
+			case NodeType::VariableDeclaration:
+			{
+				auto declaration = std::make_unique<VariableDeclarationNode>();
+				declaration->name = std::make_unique<IdentifierNode>(loader.GetSymbol(record.a));
+				declaration->initializer = loader.TakeNode(record.b, expressionTypes);
+				return std::move(declaration);
+			}
+			default:
+				ThrowCorrupt();
+				return nullptr;
+			}
+		});
+	}
+
+	namespace
+	{
+		std::string GetCachePath(const std::string& directory, const std::string& lispCode, const LispAst::ParseOptions& options)
+		{
+			uint64_t hash = 14695981039346656037ull; // FNV-1a
+			for (auto c : lispCode)
+				hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+
+			std::ostringstream path;
+			path << directory << '/' << std::hex << hash << '-' << std::dec << lispCode.size() << (options.hashCons ? "-h" : "") << ".tcai";
+			return path.str();
+		}
+	}
+
+	LispAst::NodeUniquePtr FindCachedLispAst(const std::string& directory, const std::string& lispCode, const LispAst::ParseOptions& options)
+	{
+		try
+		{
+			MappedFile image(GetCachePath(directory, lispCode, options));
+			return LoadLispAst(image.GetView());
+		}
+		catch (const std::exception&)
+		{
+			// Whatever a bad image makes the loader throw, parsing the source again is the fallback
+			return nullptr;
+		}
+	}
+
+	void CacheLispAst(const std::string& directory, const std::string& lispCode, const LispAst::ParseOptions& options, const LispAst::NodeUniquePtr& lispAst)
+	{
+		const auto path = GetCachePath(directory, lispCode, options);
+		// Unique to this write, across threads and processes sharing the directory
+		std::ostringstream tempPath;
+		tempPath << path << ".tmp" << std::hex << std::random_device()() << std::random_device()();
+
+		{
+			std::ofstream file(tempPath.str(), std::ios::binary);
+			if (file)
+				SaveLispAst(lispAst, file);
+			if (!file || !file.flush())
+			{
+				std::remove(tempPath.str().c_str());
+				throw std::runtime_error("Cannot write " + tempPath.str());
+			}
+		}
+
+		if (std::rename(tempPath.str().c_str(), path.c_str()) != 0)
+		{
+			std::remove(tempPath.str().c_str());
+			throw std::runtime_error("Cannot write " + path);
+		}
+	}
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <ostream>
+#include "compiler.h"
+
+// Versioned binary serialization of Lisp and C++ ASTs. An image is a header followed by flat arrays of fixed-size
+// records (nodes, parameters, strings) and the string bytes. Records refer to each other by index and to strings by
+// offset from the start of the image, never by pointer, so an image can be mapped from a file and read in place, from
+// any number of processes, with no deserialization. Integers are stored in native byte order; images written on a
+// machine with another byte order are rejected.
+namespace AstImage
+{
+	// Bumped on any change to the records below; images of other versions are rejected
+	const uint32_t Version = 1;
+
+	enum class AstKind : uint32_t
+	{
+		Lisp = 1,
+		Cpp = 2,
+	};
+
+	// Meaning of the a, b and c fields of a NodeRecord. Names are string indices, and parameter lists (including
+	// program bodies) are ranges of the parameter array.
+	enum class NodeType : uint8_t
+	{
+		Program = 1,			// a: name, b: first body parameter, c: body size
+		CallExpression,			// a: name (of the callee for C++), b: first parameter, c: parameter count
+		NumberLiteral,			// a: value
+		CallExpressionRef,		// a: target call node
+		Identifier,				// a: name (C++ only)
+		ExpressionStatement,	// a: expression node (C++ only)
+		VariableDeclaration,	// a: name, b: initializer node (C++ only)
+	};
+
+	const uint8_t SharedFlag = 1; // On calls referenced by CallExpressionRefs
+
+	// Nodes are stored in post-order, so children and the targets of references always precede the nodes that refer
+	// to them, and the program is last
+	struct NodeRecord
+	{
+		NodeType type;
+		uint8_t flags;
+		uint16_t reserved;
+		uint32_t a;
+		uint32_t b;
+		uint32_t c;
+	};
+
+	struct ParamRecord
+	{
+		uint32_t isLiteral;
+		uint32_t value; // The literal's bits, or a node index
+	};
+
+	// The bytes are followed by a NUL, so they can be used as a C string
+	struct StringRecord
+	{
+		uint32_t offset; // From the start of the image
+		uint32_t size;
+	};
+
+	struct Section
+	{
+		uint32_t offset; // From the start of the image
+		uint32_t count;
+	};
+
+	struct Header
+	{
+		char magic[4];		// "TCAI"
+		uint32_t byteOrder;	// ByteOrderMark, as written
+		uint32_t version;
+		AstKind kind;
+		uint32_t size;		// Of the whole image, in bytes
+		uint32_t root;		// Index of the program node
+		Section nodes;
+		Section params;
+		Section strings;
+	};
+
+	const uint32_t ByteOrderMark = 0x01020304;
+
+	// Throws std::runtime_error if the tree is too large for 32-bit offsets
+	void SaveLispAst(const LispAst::NodeUniquePtr& lispAst, std::ostream& os);
+	void SaveCppAst(const CppAst::NodeUniquePtr& cppAst, std::ostream& os);
+
+	// A read-only view of an image in memory, which must outlive it and be 8-byte aligned. Opening only checks the
+	// header and that the sections lie within the image; accessors check indices and throw std::runtime_error when
+	// they are out of range, so a corrupt image can't make a reader stray outside it.
+	class View
+	{
+	public:
+		// Throws std::runtime_error if data does not hold an image of this version and byte order
+		View(const void* data, size_t size);
+
+		AstKind GetKind() const { return m_header->kind; }
+		uint32_t GetRoot() const { return m_header->root; }
+		uint32_t GetNodeCount() const { return m_header->nodes.count; }
+
+		const NodeRecord& GetNode(uint32_t index) const;
+
+		// The parameters (or body) of a Program or CallExpression record: c records starting at b
+		const ParamRecord* GetParams(const NodeRecord& node) const;
+
+		uint32_t GetStringCount() const { return m_header->strings.count; }
+		const char* GetString(uint32_t index) const;
+		uint32_t GetStringSize(uint32_t index) const;
+
+	private:
+		const StringRecord& GetStringRecord(uint32_t index) const;
+
+		const char* m_data;
+		const Header* m_header;
+		const NodeRecord* m_nodes;
+		const ParamRecord* m_params;
+		const StringRecord* m_strings;
+	};
+
+	// An image file mapped read-only into memory, so its pages are shared with every other process mapping it. Where
+	// mmap is unavailable, the file is read into memory instead.
+	class MappedFile
+	{
+	public:
+		// Throws std::runtime_error if the file can't be read or isn't a valid image
+		explicit MappedFile(const std::string& path);
+
+		const View& GetView() const { return m_view; }
+
+	private:
+		// Owns the mapping, or the buffer holding the file, so it is released even if the view rejects the image
+		struct Mapping
+		{
+			explicit Mapping(const std::string& path);
+			~Mapping();
+
+			Mapping(const Mapping&) = delete;
+			Mapping& operator=(const Mapping&) = delete;
+
+			const void* data = nullptr;
+			size_t size = 0;
+			bool mapped = false;
+			std::vector<uint64_t> buffer;
+		};
+
+		Mapping m_mapping;
+		View m_view;
+	};
+
+	// Rebuild a tree in one pass over the node records, for the passes that work on node objects. This is a full
+	// deserialization: every node is allocated again and every name interned (once per string rather than once per
+	// node). It costs a fraction of tokenizing and parsing, but only readers of a View avoid it. Throw
+	// std::runtime_error if the image holds the other kind of AST, or its records don't form a tree in post-order with
+	// each node of a type the passes expect where it is, so a corrupt image can't give them a tree a parse couldn't.
+	LispAst::NodeUniquePtr LoadLispAst(const View& view);
+	CppAst::NodeUniquePtr LoadCppAst(const View& view);
+
+	// A cache of parsed Lisp ASTs, stored as image files in a directory and named after a hash of the source and parse
+	// options, so an unchanged source is loaded with LoadLispAst instead of being tokenized and parsed again
+
+	// Returns null on a miss, including when the cached image is unreadable, corrupt or of another version
+	LispAst::NodeUniquePtr FindCachedLispAst(const std::string& directory, const std::string& lispCode, const LispAst::ParseOptions& options);
+
+	// Writes to a temporary file renamed into place, so concurrent compiles never read a partial image. Throws
+	// std::runtime_error if the image can't be written.
+	void CacheLispAst(const std::string& directory, const std::string& lispCode, const LispAst::ParseOptions& options, const LispAst::NodeUniquePtr& lispAst);
+}
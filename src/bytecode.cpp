@@ -0,0 +1,217 @@
+#include "bytecode.h"
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+
+// Threaded dispatch: each handler jumps straight to the next one through a table of label addresses, which predicts
+// much better than a single switch. Falls back to a switch on compilers without the labels-as-values extension.
+#if defined(__GNUC__)
+#define BYTECODE_COMPUTED_GOTO 1
+#else
+#define BYTECODE_COMPUTED_GOTO 0
+#endif
+
+namespace Bytecode
+{
+	using Interpreter::Value;
+
+	namespace
+	{
+		class Compiler
+		{
+		public:
+			Compiler(const Interpreter::NativeRegistry& natives, Program& program)
+				: m_natives(natives), m_program(program)
+			{
+				m_program.natives = &natives;
+			}
+
+			void CompileProgram(const LispAst::ProgramNode& program)
+			{
+				for (auto&& bodyNode : program.body)
+				{
+					CompileExpression(bodyNode.get());
+					Emit(OpCode::StoreResult);
+					--m_depth;
+					++m_program.numResults;
+				}
+				Emit(OpCode::Halt);
+			}
+
+		private:
+			void CompileExpression(const CommonAst::Param& param)
+			{
+				if (param.IsLiteral())
+					CompilePushInt(param.GetLiteral());
+				else
+					CompileExpression(param.GetNode());
+			}
+
+			void CompileExpression(const LispAst::Node* node)
+			{
+				using namespace LispAst;
+
+				if (auto literal = AsNodePtr<const NumberLiteralNode*>(node))
+				{
+					CompilePushInt(literal->value);
+				}
+				else if (auto call = AsNodePtr<const CallExpressionNode*>(node))
+				{
+					CompileCall(*call);
+				}
+				else if (auto ref = AsNodePtr<const CallExpressionRefNode*>(node))
+				{
+					CompileCall(*ref->target);
+				}
+				else
+				{
+					assert(false && "Unhandled node type");
+				}
+			}
+
+			void CompilePushInt(int value)
+			{
+				Emit(OpCode::PushInt);
+				m_program.code.push_back(static_cast<uint32_t>(value));
+				Push(1);
+			}
+
+			// Nested calls are compiled from an explicit stack of frames rather than by recursion, so nesting depth is
+			// only limited by memory
+			void CompileCall(const LispAst::CallExpressionNode& rootCall)
+			{
+				using namespace LispAst;
+
+				m_frames.clear();
+				PushFrame(rootCall);
+				while (!m_frames.empty())
+				{
+					auto& frame = m_frames.back();
+					if (frame.nextParam < frame.call->params.size())
+					{
+						auto&& param = frame.call->params[frame.nextParam++];
+						if (auto call = AsNodePtr<const CallExpressionNode*>(param))
+							PushFrame(*call);
+						else if (auto ref = AsNodePtr<const CallExpressionRefNode*>(param))
+							PushFrame(*ref->target);
+						else
+							CompileExpression(param);
+						continue;
+					}
+
+					const auto& call = *frame.call;
+					Emit(OpCode::CallNative);
+					m_program.code.push_back(static_cast<uint32_t>(frame.id));
+					m_program.code.push_back(static_cast<uint32_t>(call.params.size()));
+					m_frames.pop_back();
+
+					// The result is written over the first argument, or one past the top with no arguments
+					Push(1);
+					m_depth -= call.params.size();
+				}
+			}
+
+			void PushFrame(const LispAst::CallExpressionNode& call)
+			{
+				const auto id = m_natives.FindId(call.name);
+				if (id == Interpreter::NativeRegistry::InvalidId)
+					throw std::runtime_error("Unknown function '" + SymbolTable::GetName(call.name) + "'");
+				m_frames.push_back(Frame{ &call, 0, id });
+			}
+
+			void Emit(OpCode opCode)
+			{
+				m_program.code.push_back(static_cast<uint32_t>(opCode));
+			}
+
+			void Push(size_t count)
+			{
+				m_depth += count;
+				m_program.maxStackDepth = std::max(m_program.maxStackDepth, m_depth);
+			}
+
+			const Interpreter::NativeRegistry& m_natives;
+			Program& m_program;
+			size_t m_depth = 0;
+
+			struct Frame
+			{
+				const LispAst::CallExpressionNode* call;
+				size_t nextParam;
+				size_t id;
+			};
+			std::vector<Frame> m_frames;
+		};
+	}
+
+	Program Compile(const LispAst::NodeUniquePtr& lispAst, const Interpreter::NativeRegistry& natives)
+	{
+		auto programNode = CommonAst::AsNodePtr<const LispAst::ProgramNode*>(lispAst);
+		assert(programNode);
+
+		Program program;
+		Compiler(natives, program).CompileProgram(*programNode);
+		return program;
+	}
+
+	std::vector<Value> Execute(const Program& program)
+	{
+		std::vector<Value> results(program.numResults);
+		std::vector<Value> stack(program.maxStackDepth);
+
+		const uint32_t* ip = program.code.data();
+		Value* sp = stack.data();
+		Value* result = results.data();
+		const auto& natives = *program.natives;
+
+#if BYTECODE_COMPUTED_GOTO
+		// Same order as OpCode
+		static void* const dispatchTable[] = { &&PushIntLabel, &&CallNativeLabel, &&StoreResultLabel, &&HaltLabel };
+#define CASE(op) op##Label:
+#define DISPATCH() goto *dispatchTable[*ip++]
+		DISPATCH();
+#else
+#define CASE(op) case OpCode::op:
+#define DISPATCH() break
+		for (;;)
+		{
+			switch (static_cast<OpCode>(*ip++))
+			{
+#endif
+
+		CASE(PushInt)
+		{
+			*sp++ = static_cast<int32_t>(*ip++);
+			DISPATCH();
+		}
+
+		CASE(CallNative)
+		{
+			auto&& entry = natives.GetEntry(ip[0]);
+			const auto argc = ip[1];
+			ip += 2;
+			sp -= argc;
+			*sp = entry.function(entry.userData, sp, argc);
+			++sp;
+			DISPATCH();
+		}
+
+		CASE(StoreResult)
+		{
+			*result++ = *--sp;
+			DISPATCH();
+		}
+
+		CASE(Halt)
+		{
+			return results;
+		}
+
+#if !BYTECODE_COMPUTED_GOTO
+			}
+		}
+#endif
+#undef CASE
+#undef DISPATCH
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "interpreter.h"
+
+// Compact bytecode for Lisp programs, executed by a stack VM. Faster than Interpreter::Evaluate on hot programs since
+// functions are resolved once at compile time and execution doesn't chase AST pointers.
+namespace Bytecode
+{
+	enum class OpCode : uint32_t
+	{
+		PushInt,		// value: push value
+		CallNative,		// id argc: pop argc arguments, call native function id on them, push its result
+		StoreResult,	// pop the value of a top-level form into the results
+		Halt,
+	};
+
+	struct Program
+	{
+		std::vector<uint32_t> code; // Opcodes, each followed by its operands
+		size_t maxStackDepth = 0;
+		size_t numResults = 0;
+		const Interpreter::NativeRegistry* natives = nullptr; // Registry the CallNative ids refer to
+	};
+
+	// Throws std::runtime_error on calls to functions that aren't registered in natives
+	Program Compile(const LispAst::NodeUniquePtr& lispAst, const Interpreter::NativeRegistry& natives);
+
+	// Returns the value of each top-level form
+	std::vector<Interpreter::Value> Execute(const Program& program);
+}
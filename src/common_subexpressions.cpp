@@ -0,0 +1,244 @@
+#include "common_subexpressions.h"
+#include <vector>
+#include <unordered_map>
+
+namespace CommonSubexpressions
+{
+	namespace
+	{
+		const size_t NoClass = static_cast<size_t>(-1);
+
+		class Eliminator
+		{
+		public:
+			explicit Eliminator(const Options& options) : m_options(options) {}
+
+			void Run(CppAst::ProgramNode& program)
+			{
+				using namespace CppAst;
+
+				for (auto&& statement : program.body)
+					Number(AsNodePtr<ExpressionStatementNode*>(statement)->expression.get());
+
+				m_counts.assign(m_classIds.size(), 0);
+				for (auto&& statement : program.body)
+					Count(AsNodePtr<ExpressionStatementNode*>(statement)->expression.get());
+
+				m_temporaries.assign(m_classIds.size(), SymbolTable::InvalidSymbol);
+				std::vector<NodeUniquePtr> body;
+				body.reserve(program.body.size());
+				for (auto&& statement : program.body)
+				{
+					Rewrite(AsNodePtr<ExpressionStatementNode*>(statement)->expression, body);
+					body.push_back(std::move(statement));
+				}
+				program.body = std::move(body);
+			}
+
+			const Result& GetResult() const { return m_result; }
+
+		private:
+			// Each pass walks the calls of a statement from an explicit stack of frames rather than by recursion, so
+			// nesting depth is only limited by memory
+			template <typename CallType>
+			struct Frame
+			{
+				CallType* call;
+				size_t nextParam;
+				size_t nodeClass;
+			};
+
+			// Assigns a value-number class to every pure call (and reference to one); calls with equal callees and
+			// equal arguments share a class. Returns the class of node, or NoClass if it isn't a pure call.
+			size_t Number(const CommonAst::Node* node)
+			{
+				using namespace CppAst;
+
+				auto root = AsNodePtr<const CallExpressionNode*>(node);
+				if (!root)
+					return GetClass(node);
+
+				// Keys of the calls being numbered, parallel to m_numberFrames
+				m_numberFrames.clear();
+				size_t numKeys = 0;
+				auto PushFrame = [&](const CallExpressionNode* call)
+				{
+					const bool isPure = m_options.pureFunctions.count(call->callee->name) != 0;
+					m_numberFrames.push_back(Frame<const CallExpressionNode>{ call, 0, isPure ? 0 : NoClass });
+					if (numKeys == m_keys.size())
+						m_keys.emplace_back();
+					m_keys[numKeys++] = std::to_string(call->callee->name) + "(";
+				};
+				auto AddParamClass = [&](size_t paramClass)
+				{
+					if (paramClass == NoClass)
+						m_numberFrames.back().nodeClass = NoClass;
+					m_keys[numKeys - 1] += 'c' + std::to_string(paramClass) + ',';
+				};
+
+				PushFrame(root);
+				while (true)
+				{
+					auto& frame = m_numberFrames.back();
+					if (frame.nextParam < frame.call->params.size())
+					{
+						auto&& param = frame.call->params[frame.nextParam++];
+						if (param.IsLiteral())
+							m_keys[numKeys - 1] += 'n' + std::to_string(param.GetLiteral()) + ',';
+						else if (auto call = AsNodePtr<const CallExpressionNode*>(param))
+							PushFrame(call);
+						else
+							AddParamClass(GetClass(param.GetNode()));
+						continue;
+					}
+
+					auto nodeClass = frame.nodeClass;
+					if (nodeClass != NoClass)
+					{
+						nodeClass = m_classIds.emplace(std::move(m_keys[numKeys - 1]), m_classIds.size()).first->second;
+						m_nodeClasses[frame.call] = nodeClass;
+					}
+					m_numberFrames.pop_back();
+					--numKeys;
+
+					if (m_numberFrames.empty())
+						return nodeClass;
+					AddParamClass(nodeClass);
+				}
+			}
+
+			// Resolves references to their target. Literal parameters have no node, and no class.
+			size_t GetClass(const CommonAst::Node* node) const
+			{
+				if (auto ref = CommonAst::AsNodePtr<const CppAst::CallExpressionRefNode*>(node))
+					node = ref->target;
+				auto iter = m_nodeClasses.find(node);
+				return iter != m_nodeClasses.end() ? iter->second : NoClass;
+			}
+
+			// Counts evaluations of each class, in evaluation order. Repeats are not descended into, as their
+			// arguments will not be evaluated again once the repeat is replaced by a temporary.
+			void Count(const CommonAst::Node* root)
+			{
+				m_countStack.assign(1, root);
+				while (!m_countStack.empty())
+				{
+					auto node = m_countStack.back();
+					m_countStack.pop_back();
+
+					const auto nodeClass = GetClass(node);
+					if (nodeClass != NoClass && m_counts[nodeClass]++ > 0)
+						continue;
+
+					// Pushed in reverse, so that they are popped in order
+					if (auto call = CommonAst::AsNodePtr<const CppAst::CallExpressionNode*>(node))
+					{
+						for (size_t i = call->params.size(); i-- > 0;)
+							m_countStack.push_back(call->params[i].GetNode());
+					}
+				}
+			}
+
+			// Replaces repeated pure calls in the statement's expression by temporaries. The declaration of each
+			// temporary is appended to declarations once the calls under it have been rewritten.
+			void Rewrite(CppAst::NodeUniquePtr& expression, std::vector<CppAst::NodeUniquePtr>& declarations)
+			{
+				m_rewriteFrames.clear();
+				Enter(expression);
+				while (!m_rewriteFrames.empty())
+				{
+					auto& frame = m_rewriteFrames.back();
+					if (frame.nextParam < frame.call->params.size())
+					{
+						Enter(frame.call->params[frame.nextParam++]);
+						continue;
+					}
+
+					const auto nodeClass = frame.nodeClass;
+					m_rewriteFrames.pop_back();
+					if (nodeClass == NoClass)
+						continue;
+
+					// The call's own slot: the statement's expression, or a parameter of the enclosing call
+					if (m_rewriteFrames.empty())
+						Hoist(expression, nodeClass, declarations);
+					else
+						Hoist(m_rewriteFrames.back().call->params[m_rewriteFrames.back().nextParam - 1], nodeClass, declarations);
+				}
+			}
+
+			// Slot is a statement's NodeUniquePtr or a call's Param. Calls to descend into are pushed on m_rewriteFrames,
+			// with the class to hoist them into if this is the first evaluation of a repeated one.
+			template <typename Slot>
+			void Enter(Slot& node)
+			{
+				using namespace CppAst;
+
+				const auto nodeClass = GetClass(GetNodePtr(node));
+				if (nodeClass != NoClass && m_counts[nodeClass] > 1)
+				{
+					if (m_temporaries[nodeClass] == SymbolTable::InvalidSymbol)
+					{
+						// First evaluation, which is always the call itself since references follow their target
+						auto call = AsNodePtr<CallExpressionNode*>(node);
+						assert(call);
+						m_rewriteFrames.push_back(Frame<CallExpressionNode>{ call, 0, nodeClass });
+					}
+					else
+					{
+						++m_result.callsEliminated;
+						node = std::make_unique<IdentifierNode>(m_temporaries[nodeClass]);
+					}
+				}
+				else if (auto call = AsNodePtr<CallExpressionNode*>(node))
+				{
+					m_rewriteFrames.push_back(Frame<CallExpressionNode>{ call, 0, NoClass });
+				}
+			}
+
+			template <typename Slot>
+			void Hoist(Slot& node, size_t nodeClass, std::vector<CppAst::NodeUniquePtr>& declarations)
+			{
+				using namespace CppAst;
+
+				auto declaration = std::make_unique<VariableDeclarationNode>();
+				declaration->name = std::make_unique<IdentifierNode>(NextTemporaryName());
+				declaration->initializer = ReleaseNode(node);
+				m_temporaries[nodeClass] = declaration->name->name;
+				declarations.push_back(std::move(declaration));
+				++m_result.temporaries;
+				node = std::make_unique<IdentifierNode>(m_temporaries[nodeClass]);
+			}
+
+			static CppAst::NodeUniquePtr ReleaseNode(CppAst::NodeUniquePtr& node) { return std::move(node); }
+			static CppAst::NodeUniquePtr ReleaseNode(CommonAst::Param& param) { return param.ReleaseNode(); }
+
+			// Lisp identifiers can't contain digits, so these never hide a function
+			Symbol NextTemporaryName()
+			{
+				return SymbolTable::Intern("t" + std::to_string(m_result.temporaries));
+			}
+
+			const Options& m_options;
+			Result m_result;
+			std::unordered_map<std::string, size_t> m_classIds;
+			std::unordered_map<const CommonAst::Node*, size_t> m_nodeClasses;
+			std::vector<size_t> m_counts;
+			std::vector<Symbol> m_temporaries;
+			std::vector<Frame<const CppAst::CallExpressionNode>> m_numberFrames;
+			std::vector<std::string> m_keys;
+			std::vector<const CommonAst::Node*> m_countStack;
+			std::vector<Frame<CppAst::CallExpressionNode>> m_rewriteFrames;
+		};
+	}
+
+	Result EliminateCommonSubexpressions(CppAst::NodeUniquePtr& cppAst, const Options& options)
+	{
+		auto program = CommonAst::AsNodePtr<CppAst::ProgramNode*>(cppAst);
+		assert(program);
+
+		Eliminator eliminator(options);
+		eliminator.Run(*program);
+		return eliminator.GetResult();
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <unordered_set>
+#include "compiler.h"
+
+// C++ AST pass that hoists calls to pure functions that are evaluated more than once into 'const auto tN = ...;'
+// locals, declared right before the first statement that needs them
+namespace CommonSubexpressions
+{
+	struct Options
+	{
+		// Functions without side effects, whose result only depends on their arguments
+		std::unordered_set<Symbol> pureFunctions;
+
+		void AddPureFunction(const std::string& name) { pureFunctions.insert(SymbolTable::Intern(name)); }
+	};
+
+	struct Result
+	{
+		size_t temporaries = 0;
+		size_t callsEliminated = 0; // Repeated calls replaced by a temporary
+	};
+
+	Result EliminateCommonSubexpressions(CppAst::NodeUniquePtr& cppAst, const Options& options);
+}
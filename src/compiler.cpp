@@ -0,0 +1,1287 @@
+#include "compiler.h"
+#include <sstream>
+#include <map>
+#include <unordered_map>
+#include <stdexcept>
+#include <functional>
+#include <algorithm>
+#include "variant_match.h"
+#include "constant_folding.h"
+
+namespace
+{
+	// Free lists of blocks for CommonAst::NodeAllocator, one per multiple of NodeSizeGranularity up to MaxPooledNodeSize.
+	// Blocks come from ::operator new and are returned to it by NodeAllocator::Trim, or when the thread exits.
+	constexpr size_t NodeSizeGranularity = 8;
+	constexpr size_t MaxPooledNodeSize = 128;
+
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	struct NodePool
+	{
+		FreeBlock* freeLists[MaxPooledNodeSize / NodeSizeGranularity] = {};
+		size_t pooledBytes = 0; // In all the free lists
+		std::vector<CommonAst::NodeUniquePtr> pendingDeletes; // See DestroyParams; kept to reuse its capacity
+
+		~NodePool();
+	};
+
+	thread_local NodePool t_nodePool;
+	thread_local bool t_nodePoolDestroyed = false; // Nodes freed during thread exit after the pool is gone go straight to the heap
+
+	NodePool::~NodePool()
+	{
+		for (auto& freeList : freeLists)
+		{
+			while (auto block = freeList)
+			{
+				freeList = block->next;
+				::operator delete(block);
+			}
+		}
+		t_nodePoolDestroyed = true;
+	}
+
+	FreeBlock** FindFreeList(size_t size)
+	{
+		if (size > MaxPooledNodeSize || t_nodePoolDestroyed)
+			return nullptr;
+		return &t_nodePool.freeLists[(size - 1) / NodeSizeGranularity];
+	}
+
+	size_t BlockSizeOf(size_t size)
+	{
+		return (size + NodeSizeGranularity - 1) / NodeSizeGranularity * NodeSizeGranularity;
+	}
+}
+
+void* CommonAst::NodeAllocator::Allocate(size_t size)
+{
+	if (auto freeList = FindFreeList(size))
+	{
+		if (auto block = *freeList)
+		{
+			*freeList = block->next;
+			t_nodePool.pooledBytes -= BlockSizeOf(size);
+			return block;
+		}
+		// Round up so that the block can be reused for anything of the same size class
+		return ::operator new(BlockSizeOf(size));
+	}
+	return ::operator new(size);
+}
+
+void CommonAst::NodeAllocator::Free(void* p, size_t size)
+{
+	if (auto freeList = FindFreeList(size))
+	{
+		auto block = static_cast<FreeBlock*>(p);
+		block->next = *freeList;
+		*freeList = block;
+		t_nodePool.pooledBytes += BlockSizeOf(size);
+		return;
+	}
+	::operator delete(p);
+}
+
+void CommonAst::NodeAllocator::Trim(size_t maxPooledBytes)
+{
+	if (t_nodePoolDestroyed)
+		return;
+
+	auto& pool = t_nodePool;
+	if (pool.pooledBytes <= maxPooledBytes)
+		return;
+
+	// Keep the first blocks of each list, smallest sizes first, up to the budget, and free the rest
+	size_t keptBytes = 0;
+	for (size_t i = 0; i < MaxPooledNodeSize / NodeSizeGranularity; ++i)
+	{
+		const size_t blockSize = (i + 1) * NodeSizeGranularity;
+		FreeBlock** link = &pool.freeLists[i];
+		while (*link && keptBytes + blockSize <= maxPooledBytes)
+		{
+			keptBytes += blockSize;
+			link = &(*link)->next;
+		}
+		while (auto block = *link)
+		{
+			*link = block->next;
+			::operator delete(block);
+		}
+	}
+	pool.pooledBytes = keptBytes;
+}
+
+size_t CommonAst::NodeAllocator::PooledBytes()
+{
+	return t_nodePoolDestroyed ? 0 : t_nodePool.pooledBytes;
+}
+
+namespace
+{
+	// Nodes queued for deletion by the outermost DestroyParams on this thread, if one is running
+	thread_local std::vector<CommonAst::NodeUniquePtr>* t_pendingDeletes = nullptr;
+}
+
+void CommonAst::DestroyParams(ParamList& params)
+{
+	if (t_pendingDeletes)
+	{
+		for (auto&& param : params)
+		{
+			if (!param.IsLiteral())
+				t_pendingDeletes->push_back(param.ReleaseNode());
+		}
+		params.clear();
+		return;
+	}
+
+	std::vector<NodeUniquePtr> threadExitDeletes;
+	auto& pendingDeletes = t_nodePoolDestroyed ? threadExitDeletes : t_nodePool.pendingDeletes;
+	t_pendingDeletes = &pendingDeletes;
+	DestroyParams(params);
+	while (!pendingDeletes.empty())
+	{
+		// Destroying the node queues its own children
+		auto node = std::move(pendingDeletes.back());
+		pendingDeletes.pop_back();
+		node.reset();
+	}
+	t_pendingDeletes = nullptr;
+}
+
+std::vector<Token> Tokenize(const std::string text)
+{
+	std::vector<Token> tokens;
+	Tokenize(text, tokens);
+	return tokens;
+}
+
+void Tokenize(const std::string& text, std::vector<Token>& tokens)
+{
+	tokens.clear();
+
+	struct Looking {};
+	struct InString { size_t start; };
+	struct InNumber { std::string value; };
+
+	auto state = variant_lib::variant<Looking, InString, InNumber>{ Looking{} };
+
+	size_t i = 0;
+	while (i < text.size())
+	{
+		const unsigned char c = text[i]; // The <cctype> functions are undefined for negative values
+		const auto cs = std::string(1, c);
+
+		match(state,
+			[&](Looking& looking)
+			{
+				if (c == ' ' || c == '\t' || c == '\n') // Whitespace
+				{
+					++i;
+				}
+				else if (c == '(' || c == ')')
+				{
+					tokens.emplace_back(Token{ Token::Type::Paren, cs });
+					++i;
+				}
+				else if (isalpha(c))
+				{
+					state = InString{ i };
+				}
+				else if (isdigit(c))
+				{
+					state = InNumber{};
+				}
+				else
+				{
+					throw std::logic_error("Unexpected character");
+				}
+			},
+			[&](InString& inString)
+			{
+				if (isalpha(c))
+				{
+					++i;
+				}
+				else
+				{
+					tokens.emplace_back(Token{ Token::Type::Name, std::string(), SymbolTable::Intern(&text[inString.start], i - inString.start) });
+					state = Looking{};
+				}
+			},
+			[&](InNumber& inNumber)
+			{
+				if (isdigit(c))
+				{
+					inNumber.value += cs;
+					++i;
+				}
+				else
+				{
+					tokens.emplace_back(Token{ Token::Type::Number, inNumber.value });
+					state = Looking{};
+				}
+			}
+		);
+	}
+}
+
+namespace LispAst
+{
+	namespace
+	{
+		// Maps the structure of a call (its name plus the identity of each parameter) to the first call parsed with
+		// that structure. Calls are registered bottom-up, so identical parameter subtrees already share one identity.
+		class HashConsTable
+		{
+		public:
+			// Returns the previously registered call identical to callExpression, or registers it and returns null
+			CallExpressionNode* FindOrAdd(CallExpressionNode& callExpression)
+			{
+				m_key.clear();
+				Append(callExpression.name);
+				for (auto&& param : callExpression.params)
+				{
+					if (param.IsLiteral())
+					{
+						m_key += 'n';
+						Append(param.GetLiteral());
+					}
+					else if (auto node = AsNodePtr<const CallExpressionRefNode*>(param))
+					{
+						m_key += 'c';
+						Append(node->target);
+					}
+					else
+					{
+						m_key += 'c';
+						Append(param.GetNode());
+					}
+				}
+
+				auto result = m_calls.emplace(m_key, &callExpression);
+				return result.second ? nullptr : result.first->second;
+			}
+
+		private:
+			template <typename T>
+			void Append(const T& value)
+			{
+				m_key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+			}
+
+			std::string m_key;
+			std::unordered_map<std::string, CallExpressionNode*> m_calls;
+		};
+
+		// Parses a top-level call, whose '(' has been consumed. Calls that are still open are kept on an explicit stack
+		// rather than the call stack, so nesting depth is only limited by memory.
+		NodeUniquePtr ParseCallExpression(std::vector<Token>::const_iterator& iter, const std::vector<Token>::const_iterator& endIter, HashConsTable* hashConsTable)
+		{
+			std::vector<std::unique_ptr<CallExpressionNode>> openCalls;
+
+			auto OpenCall = [&]
+			{
+				if (iter == endIter || iter->type != Token::Type::Name)
+					throw std::logic_error("Expecting function name immediately after '('");
+
+				openCalls.push_back(std::make_unique<CallExpressionNode>());
+				openCalls.back()->name = iter->name;
+				++iter;
+			};
+
+			OpenCall();
+			while (iter != endIter)
+			{
+				switch (iter->type)
+				{
+				case Token::Type::Paren:
+					if (iter->value == ")")
+					{
+						++iter;
+
+						auto callExpression = std::move(openCalls.back());
+						openCalls.pop_back();
+						const bool isTopLevel = openCalls.empty();
+
+						// Top-level calls are statements and stay in place, but can be the target of later references
+						NodeUniquePtr node;
+						auto canonical = hashConsTable ? hashConsTable->FindOrAdd(*callExpression) : nullptr;
+						if (canonical && !isTopLevel)
+						{
+							canonical->shared = true;
+							node = std::make_unique<CallExpressionRefNode>(canonical);
+						}
+						else
+						{
+							node = std::move(callExpression);
+						}
+
+						if (isTopLevel)
+							return node;
+						openCalls.back()->params.emplace_back(std::move(node));
+					}
+					else
+					{
+						++iter;
+						OpenCall();
+					}
+					break;
+
+				case Token::Type::Name:
+					throw std::logic_error("Unexpected name token in argument list");
+					break;
+
+				case Token::Type::Number:
+					openCalls.back()->params.emplace_back(Param::Literal(stoi(iter->value)));
+					++iter;
+					break;
+				}
+			}
+
+			throw std::logic_error("Missing ')' to end call expression");
+			return nullptr;
+		}
+	}
+
+	NodeUniquePtr Parse(const std::vector<Token>& tokens, const ParseOptions& options)
+	{
+		using namespace LispAst;
+		auto programNode = std::make_unique<ProgramNode>();
+
+		auto tokenIter = begin(tokens);
+		auto tokenEnd = end(tokens);
+
+		HashConsTable hashConsTable;
+
+		// Loop here for each top-level call expression
+		// e.g.
+		//		(add 1 2)
+		//		(sub 3 4)
+		while (tokenIter != tokenEnd)
+		{
+			const auto& firstToken = *tokenIter;
+			if (!(firstToken.type == Token::Type::Paren && firstToken.value == "("))
+				throw std::logic_error("Program must start with '('");
+			++tokenIter;
+
+			programNode->body.emplace_back(ParseCallExpression(tokenIter, tokenEnd, options.hashCons ? &hashConsTable : nullptr));
+		}
+
+		return std::move(programNode);
+	}
+
+	void Visit(const NodeUniquePtr& rootNode, const Node* parent, Visitor& visitor, int depth)
+	{
+		// Pending nodes, with children pushed in reverse so they pop in order. A null node is a literal parameter.
+		struct Pending
+		{
+			const Node* node;
+			int literal;
+			const Node* parent;
+			int depth;
+		};
+		std::vector<Pending> stack;
+		stack.push_back(Pending{ rootNode.get(), 0, parent, depth });
+
+		while (!stack.empty())
+		{
+			const auto pending = stack.back();
+			stack.pop_back();
+
+			if (!pending.node)
+			{
+				visitor.OnVisitLiteral(pending.literal, *static_cast<const CallExpressionNode*>(pending.parent), pending.depth);
+			}
+			else if (auto node = AsNodePtr<const ProgramNode*>(pending.node))
+			{
+				assert(pending.parent == nullptr);
+				visitor.OnVisit(*node, pending.depth);
+				for (auto iter = node->body.rbegin(); iter != node->body.rend(); ++iter)
+					stack.push_back(Pending{ iter->get(), 0, node, pending.depth + 1 });
+			}
+			else if (auto node = AsNodePtr<const CallExpressionNode*>(pending.node))
+			{
+				visitor.OnVisit(*node, *pending.parent, pending.depth);
+				for (auto iter = node->params.end(); iter != node->params.begin();)
+				{
+					--iter;
+					stack.push_back(Pending{ iter->GetNode(), iter->IsLiteral() ? iter->GetLiteral() : 0, node, pending.depth + 1 });
+				}
+			}
+			else if (auto node = AsNodePtr<const NumberLiteralNode*>(pending.node))
+			{
+				visitor.OnVisit(*node, *pending.parent, pending.depth);
+			}
+			else if (auto node = AsNodePtr<const CallExpressionRefNode*>(pending.node))
+			{
+				visitor.OnVisit(*node, *pending.parent, pending.depth);
+			}
+			else
+			{
+				assert(false && "Unhandled node type");
+			}
+		}
+	}
+
+	void PrintAst(const NodeUniquePtr& lispAst, std::ostream& os)
+	{
+		struct PrintAST : Visitor
+		{
+			std::ostream& os;
+			PrintAST(std::ostream& os) : os(os) {}
+
+			void Indent(int depth)
+			{
+				for (int i = 0; i < depth; ++i)
+				{
+					os << "  ";
+				}
+			}
+
+			virtual void OnVisit(const ProgramNode& program, int depth)
+			{
+				os << "[Program]\n";
+			}
+			virtual void OnVisit(const CallExpressionNode& callExpression, const Node& parent, int depth)
+			{
+				Indent(depth);
+				os << "[CallExpression] name: " << SymbolTable::GetName(callExpression.name) << '\n';
+			}
+			virtual void OnVisit(const NumberLiteralNode& numberLiteral, const Node& parent, int depth)
+			{
+				Indent(depth);
+				os << "[NumberLiteral] value: " << numberLiteral.value << '\n';
+			}
+			virtual void OnVisit(const CallExpressionRefNode& callExpressionRef, const Node& parent, int depth)
+			{
+				Indent(depth);
+				os << "[CallExpressionRef] name: " << SymbolTable::GetName(callExpressionRef.target->name) << '\n';
+			}
+		};
+
+		auto printAST = PrintAST(os);
+		LispAst::Visit(lispAst, nullptr, printAST);
+	}
+} // namespace LispAst
+
+namespace CppAst
+{
+	void PrintAst(const NodeUniquePtr& cppAst, std::ostream& os)
+	{
+		// Pending lines, with children pushed in reverse so they pop in order. Each is a heading, a parameter or a node.
+		struct Pending
+		{
+			const char* heading;
+			const Param* param;
+			const Node* node;
+			int depth;
+		};
+		std::vector<Pending> stack;
+		stack.push_back(Pending{ nullptr, nullptr, cppAst.get(), 0 });
+
+		auto Indent = [&os](int depth)
+		{
+			for (int i = 0; i < depth; ++i)
+			{
+				os << "  ";
+			}
+		};
+
+		auto PushHeading = [&stack](const char* heading, int depth) { stack.push_back(Pending{ heading, nullptr, nullptr, depth }); };
+		auto PushNode = [&stack](const Node* node, int depth) { stack.push_back(Pending{ nullptr, nullptr, node, depth }); };
+
+		while (!stack.empty())
+		{
+			const auto pending = stack.back();
+			stack.pop_back();
+			const auto depth = pending.depth;
+
+			if (pending.heading)
+			{
+				Indent(depth); os << pending.heading;
+				continue;
+			}
+
+			if (pending.param && pending.param->IsLiteral())
+			{
+				Indent(depth); os << "[NumberLiteralNode] value: " << pending.param->GetLiteral() << '\n';
+				continue;
+			}
+
+			const Node* rootNode = pending.param ? pending.param->GetNode() : pending.node;
+			if (auto node = AsNodePtr<const ProgramNode*>(rootNode))
+			{
+				Indent(depth); os << "[Program]\n";
+				for (auto iter = node->body.rbegin(); iter != node->body.rend(); ++iter)
+					PushNode(iter->get(), depth + 1);
+				PushHeading(" Body:\n", depth);
+			}
+			else if (auto node = AsNodePtr<const ExpressionStatementNode*>(rootNode))
+			{
+				Indent(depth); os << "[ExpressionStatement]\n";
+				PushNode(node->expression.get(), depth + 1);
+				PushHeading(" Expression:\n", depth);
+			}
+			else if (auto node = AsNodePtr<const VariableDeclarationNode*>(rootNode))
+			{
+				Indent(depth); os << "[VariableDeclaration]\n";
+				PushNode(node->initializer.get(), depth + 1);
+				PushHeading(" Initializer:\n", depth);
+				PushNode(node->name.get(), depth + 1);
+				PushHeading(" Name:\n", depth);
+			}
+			else if (auto node = AsNodePtr<const CallExpressionNode*>(rootNode))
+			{
+				Indent(depth); os << "[CallExpression]\n";
+				for (auto iter = node->params.end(); iter != node->params.begin();)
+				{
+					--iter;
+					stack.push_back(Pending{ nullptr, iter, nullptr, depth + 1 });
+				}
+				PushHeading(" Params:\n", depth);
+				PushNode(node->callee.get(), depth + 1);
+				PushHeading(" Callee:\n", depth);
+			}
+			else if (auto node = AsNodePtr<const CallExpressionRefNode*>(rootNode))
+			{
+				Indent(depth); os << "[CallExpressionRef] callee: " << SymbolTable::GetName(node->target->callee->name) << '\n';
+			}
+			else if (auto node = AsNodePtr<const IdentifierNode*>(rootNode))
+			{
+				Indent(depth); os << "[Identifier] name: " << SymbolTable::GetName(node->name) << '\n';
+			}
+			else if (auto node = AsNodePtr<const NumberLiteralNode*>(rootNode))
+			{
+				Indent(depth); os << "[NumberLiteralNode] value: " << node->value << '\n';
+			}
+			else
+			{
+				assert(false && "Unhandled node type");
+			}
+		}
+	}
+} // namespace CppAst
+
+// std::less<reference_wrapper<T>> doesn't work in containers like map, so use this instead
+template <typename T>
+struct reference_wrapper_less
+{
+	bool operator()(const std::reference_wrapper<T>& lhs, const std::reference_wrapper<T>& rhs) const { return &lhs.get() < &rhs.get(); }
+};
+
+CppAst::NodeUniquePtr TransformLispAstToCppAst(const LispAst::NodeUniquePtr& lispAst)
+{
+	struct Transformer : LispAst::Visitor
+	{
+		CppAst::NodeUniquePtr m_programNode;
+
+		// Either a program body or call parameters
+		struct ChildList
+		{
+			std::vector<CppAst::NodeUniquePtr>* body = nullptr;
+			CppAst::ParamList* params = nullptr;
+
+			void push_back(CppAst::NodeUniquePtr node)
+			{
+				if (body)
+					body->push_back(std::move(node));
+				else
+					params->push_back(std::move(node));
+			}
+		};
+
+		// Map of Lisp parent nodes to Cpp lists of nodes. This basically allows us to find the relevant parent
+		// list to add a Cpp node to from within visitor callbacks.
+		std::map<
+			std::reference_wrapper<const LispAst::Node>,
+			ChildList,
+			reference_wrapper_less<const LispAst::Node>
+		> m_context;
+
+		// Cpp nodes lowered from shared (hash-consed) Lisp calls, so references to them can be lowered to references
+		std::unordered_map<const LispAst::CallExpressionNode*, const CppAst::CallExpressionNode*> m_sharedCalls;
+
+		void AddNodeToVectorMapping(const LispAst::Node& node, std::vector<CppAst::NodeUniquePtr>& body)
+		{
+			ChildList list;
+			list.body = &body;
+			m_context.emplace(std::cref(node), list);
+		}
+
+		void AddNodeToVectorMapping(const LispAst::Node& node, CppAst::ParamList& params)
+		{
+			ChildList list;
+			list.params = &params;
+			m_context.emplace(std::cref(node), list);
+		}
+
+		ChildList& GetContextVector(const LispAst::Node& lispNode)
+		{
+			auto iter = m_context.find(lispNode);
+			assert(iter != m_context.end());
+			return iter->second;
+		}
+
+		virtual void OnVisit(const LispAst::ProgramNode& lispProgramNode, int depth)
+		{
+			assert(m_programNode == nullptr);
+			auto cppProgramNode = std::make_unique<CppAst::ProgramNode>();
+			AddNodeToVectorMapping(lispProgramNode, cppProgramNode->body);
+			m_programNode = std::move(cppProgramNode);
+		}
+
+		virtual void OnVisit(const LispAst::CallExpressionNode& lispCallExpressionNode, const LispAst::Node& parent, int depth)
+		{
+			assert(m_programNode);
+
+			// Create call expression with nested identifier and no parameters
+			auto callExpressionNode = std::make_unique<CppAst::CallExpressionNode>();
+			callExpressionNode->callee = std::make_unique<CppAst::IdentifierNode>(lispCallExpressionNode.name);
+
+			// Add mapping from the Lisp CallExpressionNode to the parameter vector of our new Cpp CallExpressionNode
+			AddNodeToVectorMapping(lispCallExpressionNode, callExpressionNode->params);
+
+			if (lispCallExpressionNode.shared)
+			{
+				callExpressionNode->shared = true;
+				m_sharedCalls.emplace(&lispCallExpressionNode, callExpressionNode.get());
+			}
+
+			auto newNode = [&]() -> CppAst::NodeUniquePtr
+			{
+				// If parent is not a CallExpression, we wrap up our Cpp CallExpression node with an ExpressionStatement,
+				// because in C++, top-level call expressions are statements.
+				if (!dynamic_cast<const LispAst::CallExpressionNode*>(&parent))
+				{
+					auto expressionStatementNode = std::make_unique<CppAst::ExpressionStatementNode>();
+					expressionStatementNode->expression = std::move(callExpressionNode);
+					//callExpressionNode = std::move(expressionStatementNode);
+					return std::move(expressionStatementNode);
+				}
+				else
+				{
+					return std::move(callExpressionNode);
+				}
+			} ();
+
+			// Add new node to parent's context
+			GetContextVector(parent).push_back(std::move(newNode));
+		}
+
+		// Constant folding can reduce a top-level call to a literal, which is still a statement
+		virtual void OnVisit(const LispAst::NumberLiteralNode& lispNumberLiteralNode, const LispAst::Node& parent, int depth)
+		{
+			assert(m_programNode);
+			auto expressionStatementNode = std::make_unique<CppAst::ExpressionStatementNode>();
+			expressionStatementNode->expression = std::make_unique<CppAst::NumberLiteralNode>(lispNumberLiteralNode.value);
+			GetContextVector(parent).push_back(std::move(expressionStatementNode));
+		}
+
+		virtual void OnVisitLiteral(int value, const LispAst::CallExpressionNode& parent, int depth)
+		{
+			assert(m_programNode);
+			GetContextVector(parent).params->push_back(CppAst::Param::Literal(value));
+		}
+
+		virtual void OnVisit(const LispAst::CallExpressionRefNode& lispCallExpressionRefNode, const LispAst::Node& parent, int depth)
+		{
+			// The shared target precedes all references to it in visitation order, so it has already been lowered
+			auto iter = m_sharedCalls.find(lispCallExpressionRefNode.target);
+			assert(iter != m_sharedCalls.end());
+			GetContextVector(parent).push_back(std::make_unique<CppAst::CallExpressionRefNode>(iter->second));
+		}
+	};
+
+	auto transformer = Transformer();
+	LispAst::Visit(lispAst, nullptr, transformer);
+
+	return std::move(transformer.m_programNode);
+}
+
+CppAst::NodeUniquePtr TransformLispAstToCppAst(LispAst::NodeUniquePtr&& lispAst)
+{
+	// Lowers each Lisp node into a Cpp node that takes over its parameter vector, replacing the Lisp children in
+	// place with their lowered versions. Each Lisp node is freed as soon as it is lowered. Parameters still to be
+	// lowered wait on an explicit stack, and are lowered in tree order so shared calls precede references to them.
+	struct ConsumingTransformer
+	{
+		// Only compared against CallExpressionRefNode targets, never dereferenced, so these may outlive the Lisp nodes
+		std::unordered_map<const LispAst::CallExpressionNode*, const CppAst::CallExpressionNode*> m_sharedCalls;
+
+		// Point into the parameter vectors of Cpp nodes, which don't change size once lowered
+		std::vector<CommonAst::Param*> m_pendingParams;
+
+		CppAst::NodeUniquePtr LowerProgram(LispAst::NodeUniquePtr lispNode)
+		{
+			auto lispProgramNode = CommonAst::AsNodePtr<LispAst::ProgramNode*>(lispNode);
+			assert(lispProgramNode);
+
+			auto programNode = std::make_unique<CppAst::ProgramNode>();
+			programNode->body = std::move(lispProgramNode->body);
+			lispNode.reset();
+			for (auto&& bodyNode : programNode->body)
+			{
+				auto expressionStatementNode = std::make_unique<CppAst::ExpressionStatementNode>();
+				expressionStatementNode->expression = Lower(std::move(bodyNode));
+				bodyNode = std::move(expressionStatementNode);
+
+				while (!m_pendingParams.empty())
+				{
+					auto param = m_pendingParams.back();
+					m_pendingParams.pop_back();
+					*param = Lower(param->ReleaseNode());
+				}
+			}
+			return std::move(programNode);
+		}
+
+		// Lowers lispNode itself; the parameters of a call are queued
+		CppAst::NodeUniquePtr Lower(LispAst::NodeUniquePtr lispNode)
+		{
+			if (auto lispCallExpressionNode = CommonAst::AsNodePtr<LispAst::CallExpressionNode*>(lispNode))
+			{
+				auto callExpressionNode = std::make_unique<CppAst::CallExpressionNode>();
+				callExpressionNode->callee = std::make_unique<CppAst::IdentifierNode>(lispCallExpressionNode->name);
+				callExpressionNode->params = std::move(lispCallExpressionNode->params);
+				if (lispCallExpressionNode->shared)
+				{
+					callExpressionNode->shared = true;
+					m_sharedCalls.emplace(lispCallExpressionNode, callExpressionNode.get());
+				}
+				lispNode.reset();
+
+				// Literal parameters are the same in both trees
+				auto&& params = callExpressionNode->params;
+				for (auto iter = params.end(); iter != params.begin();)
+				{
+					--iter;
+					if (!iter->IsLiteral())
+						m_pendingParams.push_back(iter);
+				}
+				return std::move(callExpressionNode);
+			}
+			else if (auto lispNumberLiteralNode = CommonAst::AsNodePtr<const LispAst::NumberLiteralNode*>(lispNode))
+			{
+				return std::make_unique<CppAst::NumberLiteralNode>(lispNumberLiteralNode->value);
+			}
+			else if (auto lispCallExpressionRefNode = CommonAst::AsNodePtr<const LispAst::CallExpressionRefNode*>(lispNode))
+			{
+				auto iter = m_sharedCalls.find(lispCallExpressionRefNode->target);
+				assert(iter != m_sharedCalls.end());
+				return std::make_unique<CppAst::CallExpressionRefNode>(iter->second);
+			}
+
+			assert(false && "Unhandled node type");
+			return nullptr;
+		}
+	};
+
+	return ConsumingTransformer().LowerProgram(std::move(lispAst));
+}
+
+namespace impl
+{
+	struct CodeGenContext
+	{
+		// Generated code for shared call nodes, so each shared subtree is only generated once
+		std::unordered_map<const CppAst::CallExpressionNode*, std::string> sharedCode;
+
+		// Names of the constexpr variables holding the values of constant calls
+		std::unordered_map<const CppAst::CallExpressionNode*, std::string> constantNames;
+	};
+
+	bool IsConstant(const CppAst::NodeUniquePtr& node, const CodeGenContext& context)
+	{
+		using namespace CppAst;
+
+		const CallExpressionNode* call = AsNodePtr<const CallExpressionNode*>(node);
+		if (auto ref = AsNodePtr<const CallExpressionRefNode*>(node))
+			call = ref->target;
+		return call && context.constantNames.count(call) != 0;
+	}
+
+	// Whether node is emitted as a call, rather than as a value without side effects
+	bool IsCall(const CppAst::NodeUniquePtr& node, const CodeGenContext& context)
+	{
+		using namespace CppAst;
+
+		return (AsNodePtr<const CallExpressionNode*>(node) || AsNodePtr<const CallExpressionRefNode*>(node))
+			&& !IsConstant(node, context);
+	}
+
+	// Writes code from an explicit stack of pending work rather than by recursion, so deep trees can't overflow the
+	// call stack
+	class CodeEmitter
+	{
+	public:
+		explicit CodeEmitter(CodeGenContext& context) : m_context(context) {}
+
+		void Emit(const CppAst::Node* rootNode, std::ostream& os)
+		{
+			Run(Pending{ Pending::Kind::Node, rootNode, nullptr, 0 }, os);
+		}
+
+		// Spells out the call, even if it is constant or shared
+		void EmitCallExpression(const CppAst::CallExpressionNode& node, std::ostream& os)
+		{
+			Run(Pending{ Pending::Kind::CallExpression, &node, nullptr, 0 }, os);
+		}
+
+	private:
+		struct Pending
+		{
+			enum class Kind
+			{
+				Node,			// Node at depth value
+				CallExpression,	// CallExpressionNode to spell out
+				Literal,		// Literal parameter value
+				Text,			// text
+				EndSharedCall,	// Done generating the code of shared CallExpressionNode node
+			};
+
+			Kind kind;
+			const CppAst::Node* node;
+			const char* text;
+			int value;
+		};
+
+		void Run(Pending first, std::ostream& os)
+		{
+			m_out = &os;
+			m_stack.push_back(first);
+			while (!m_stack.empty())
+			{
+				const auto pending = m_stack.back();
+				m_stack.pop_back();
+
+				switch (pending.kind)
+				{
+				case Pending::Kind::Node:
+					EmitNode(pending.node, pending.value);
+					break;
+
+				case Pending::Kind::CallExpression:
+					EmitCall(static_cast<const CppAst::CallExpressionNode&>(*pending.node));
+					break;
+
+				case Pending::Kind::Literal:
+					*m_out << pending.value;
+					break;
+
+				case Pending::Kind::Text:
+					*m_out << pending.text;
+					break;
+
+				case Pending::Kind::EndSharedCall:
+				{
+					const auto code = m_sharedCallStreams.back()->str();
+					m_sharedCallStreams.pop_back();
+					m_out = m_sharedCallStreams.empty() ? &os : m_sharedCallStreams.back().get();
+					*m_out << code;
+					m_context.sharedCode.emplace(static_cast<const CppAst::CallExpressionNode*>(pending.node), code);
+					break;
+				}
+				}
+			}
+		}
+
+		void PushNode(const CppAst::Node* node, int depth) { m_stack.push_back(Pending{ Pending::Kind::Node, node, nullptr, depth }); }
+		void PushText(const char* text) { m_stack.push_back(Pending{ Pending::Kind::Text, nullptr, text, 0 }); }
+
+		void Indent(int depth)
+		{
+			for (int i = 0; i < depth; ++i)
+			{
+				*m_out << "  ";
+			}
+		}
+
+		// Writes what comes before node's children, and pushes the children and what comes after them
+		void EmitNode(const CppAst::Node* rootNode, int depth)
+		{
+			using namespace CppAst;
+
+			if (auto node = AsNodePtr<const ProgramNode*>(rootNode))
+			{
+				*m_out << "int main()\n";
+				*m_out << "{\n";
+				PushText("}\n");
+				for (auto iter = node->body.rbegin(); iter != node->body.rend(); ++iter)
+					PushNode(iter->get(), depth + 1);
+			}
+			else if (auto node = AsNodePtr<const ExpressionStatementNode*>(rootNode))
+			{
+				Indent(depth);
+				if (!IsCall(node->expression, m_context))
+				{
+					// Only a call can have an effect; discarding any other value on its own would warn about a statement
+					// with no effect
+					*m_out << "static_cast<void>(";
+					PushText(");\n");
+				}
+				else
+				{
+					PushText(";\n");
+				}
+				PushNode(node->expression.get(), depth + 1);
+			}
+			else if (auto node = AsNodePtr<const VariableDeclarationNode*>(rootNode))
+			{
+				Indent(depth);
+				*m_out << "const auto " << SymbolTable::GetName(node->name->name) << " = ";
+				PushText(";\n");
+				PushNode(node->initializer.get(), depth + 1);
+			}
+			else if (auto node = AsNodePtr<const CallExpressionNode*>(rootNode))
+			{
+				EmitAnyCall(*node);
+			}
+			else if (auto node = AsNodePtr<const CallExpressionRefNode*>(rootNode))
+			{
+				EmitAnyCall(*node->target);
+			}
+			else if (auto node = AsNodePtr<const IdentifierNode*>(rootNode))
+			{
+				*m_out << SymbolTable::GetName(node->name);
+			}
+			else if (auto node = AsNodePtr<const NumberLiteralNode*>(rootNode))
+			{
+				*m_out << node->value;
+			}
+			else
+			{
+				assert(false && "Unhandled node type");
+			}
+		}
+
+		void EmitAnyCall(const CppAst::CallExpressionNode& node)
+		{
+			auto constant = m_context.constantNames.find(&node);
+			if (constant != m_context.constantNames.end())
+			{
+				*m_out << constant->second;
+				return;
+			}
+
+			if (node.shared)
+			{
+				// Each shared subtree is only generated once, into its own stream
+				auto iter = m_context.sharedCode.find(&node);
+				if (iter != m_context.sharedCode.end())
+				{
+					*m_out << iter->second;
+					return;
+				}
+				m_stack.push_back(Pending{ Pending::Kind::EndSharedCall, &node, nullptr, 0 });
+				m_sharedCallStreams.push_back(std::make_unique<std::ostringstream>());
+				m_out = m_sharedCallStreams.back().get();
+			}
+			EmitCall(node);
+		}
+
+		void EmitCall(const CppAst::CallExpressionNode& node)
+		{
+			*m_out << SymbolTable::GetName(node.callee->name) << "(";
+			PushText(")");
+			for (size_t i = node.params.size(); i-- > 0;)
+			{
+				auto&& param = node.params[i];
+				if (param.IsLiteral())
+					m_stack.push_back(Pending{ Pending::Kind::Literal, nullptr, nullptr, param.GetLiteral() });
+				else
+					PushNode(param.GetNode(), 0);
+				if (i > 0)
+					PushText(", ");
+			}
+		}
+
+		CodeGenContext& m_context;
+		std::vector<Pending> m_stack;
+		std::ostream* m_out = nullptr;
+		std::vector<std::unique_ptr<std::ostringstream>> m_sharedCallStreams;
+	};
+
+	// C++14 constexpr definitions of the builtins ConstantFolding knows, with the same semantics
+	struct BuiltinDefinition
+	{
+		const char* name;
+		const char* definition;
+	};
+
+	const BuiltinDefinition BuiltinDefinitions[] =
+	{
+		{ "add",
+			"template <typename... Args>\n"
+			"constexpr int add(Args... args)\n"
+			"{\n"
+			"  int result = 0;\n"
+			"  for (int arg : { 0, args... })\n"
+			"    result += arg;\n"
+			"  return result;\n"
+			"}\n" },
+		{ "subtract",
+			"template <typename... Args>\n"
+			"constexpr int subtract(int first, Args... rest)\n"
+			"{\n"
+			"  if (sizeof...(rest) == 0)\n"
+			"    return -first;\n"
+			"  for (int arg : { 0, rest... })\n"
+			"    first -= arg;\n"
+			"  return first;\n"
+			"}\n" },
+		{ "multiply",
+			"template <typename... Args>\n"
+			"constexpr int multiply(Args... args)\n"
+			"{\n"
+			"  int result = 1;\n"
+			"  for (int arg : { 1, args... })\n"
+			"    result *= arg;\n"
+			"  return result;\n"
+			"}\n" },
+	};
+
+	// Finds the calls to builtins with only literal arguments (outermost ones only) and generates a constexpr
+	// variable for each, recording its name in the context. Also collects which builtins the program calls.
+	class ConstantCollector
+	{
+	public:
+		ConstantCollector(CodeGenContext& context, std::ostream& declarations) : m_context(context), m_declarations(declarations), m_emitter(context) {}
+
+		void Collect(const CppAst::NodeUniquePtr& rootNode)
+		{
+			using namespace CppAst;
+
+			EvaluateConstants(rootNode.get());
+
+			// In tree order, so the variables are numbered in order of first use
+			std::vector<const Node*> stack{ rootNode.get() };
+			while (!stack.empty())
+			{
+				const auto current = stack.back();
+				stack.pop_back();
+
+				if (auto node = AsNodePtr<const ProgramNode*>(current))
+				{
+					for (auto iter = node->body.rbegin(); iter != node->body.rend(); ++iter)
+						stack.push_back(iter->get());
+				}
+				else if (auto node = AsNodePtr<const ExpressionStatementNode*>(current))
+				{
+					stack.push_back(node->expression.get());
+				}
+				else if (auto node = AsNodePtr<const VariableDeclarationNode*>(current))
+				{
+					stack.push_back(node->initializer.get());
+				}
+				else if (auto node = AsNodePtr<const CallExpressionNode*>(current))
+				{
+					if (!CollectConstant(*node))
+					{
+						// Builtins called at run time need definitions too
+						UseBuiltin(node->callee->name);
+						for (size_t i = node->params.size(); i-- > 0;)
+						{
+							if (!node->params[i].IsLiteral())
+								stack.push_back(node->params[i].GetNode());
+						}
+					}
+				}
+				else if (auto node = AsNodePtr<const CallExpressionRefNode*>(current))
+				{
+					CollectConstant(*node->target);
+				}
+			}
+		}
+
+		const std::vector<const BuiltinDefinition*>& GetUsedBuiltins() const { return m_usedBuiltins; }
+
+	private:
+		// Computes the value of every call to a builtin whose arguments are literals or such calls, bottom-up in a
+		// single pass. Calls to unknown functions and calls that overflow wouldn't be constant expressions.
+		void EvaluateConstants(const CppAst::Node* rootNode)
+		{
+			using namespace CppAst;
+
+			// Calls whose arguments are being evaluated, innermost last. The arguments evaluated so far for all of them
+			// are in args.
+			struct Frame
+			{
+				const CallExpressionNode* call;
+				ConstantFolding::BuiltinFunction builtin;
+				size_t nextParam;
+				size_t argsBase;
+				bool constant;
+			};
+			std::vector<Frame> frames;
+			std::vector<int> args;
+
+			auto Enter = [&](const CallExpressionNode& call)
+			{
+				auto builtin = ConstantFolding::FindKnownBuiltin(SymbolTable::GetName(call.callee->name));
+				frames.push_back(Frame{ &call, builtin, 0, args.size(), builtin != nullptr });
+			};
+
+			std::vector<const Node*> roots{ rootNode };
+			while (!roots.empty())
+			{
+				const auto current = roots.back();
+				roots.pop_back();
+
+				if (auto node = AsNodePtr<const ProgramNode*>(current))
+				{
+					for (auto iter = node->body.rbegin(); iter != node->body.rend(); ++iter)
+						roots.push_back(iter->get());
+				}
+				else if (auto node = AsNodePtr<const ExpressionStatementNode*>(current))
+				{
+					roots.push_back(node->expression.get());
+				}
+				else if (auto node = AsNodePtr<const VariableDeclarationNode*>(current))
+				{
+					roots.push_back(node->initializer.get());
+				}
+				else if (auto node = AsNodePtr<const CallExpressionNode*>(current))
+				{
+					Enter(*node);
+				}
+
+				while (!frames.empty())
+				{
+					auto& frame = frames.back();
+					if (frame.nextParam < frame.call->params.size())
+					{
+						auto&& param = frame.call->params[frame.nextParam++];
+						if (param.IsLiteral())
+						{
+							args.push_back(param.GetLiteral());
+						}
+						else if (auto call = AsNodePtr<const CallExpressionNode*>(param))
+						{
+							Enter(*call);
+						}
+						else
+						{
+							// References follow their target, which has been evaluated already
+							auto ref = AsNodePtr<const CallExpressionRefNode*>(param);
+							auto value = ref ? m_values.find(ref->target) : m_values.end();
+							frame.constant = frame.constant && value != m_values.end();
+							args.push_back(value != m_values.end() ? value->second : 0);
+						}
+						continue;
+					}
+
+					int value = 0;
+					const bool constant = frame.constant && frame.builtin(args.data() + frame.argsBase, args.size() - frame.argsBase, value);
+					if (constant)
+						m_values.emplace(frame.call, value);
+					args.resize(frame.argsBase);
+					frames.pop_back();
+
+					if (!frames.empty())
+					{
+						frames.back().constant = frames.back().constant && constant;
+						args.push_back(value);
+					}
+				}
+			}
+		}
+
+		bool CollectConstant(const CppAst::CallExpressionNode& node)
+		{
+			if (m_context.constantNames.count(&node) != 0)
+				return true;
+
+			if (m_values.count(&node) == 0)
+				return false;
+
+			// Generated before the name is recorded, so the initializer spells out the call
+			std::ostringstream initializer;
+			m_emitter.EmitCallExpression(node, initializer);
+
+			// Identical calls share a variable
+			auto iter = m_namesByInitializer.find(initializer.str());
+			if (iter == m_namesByInitializer.end())
+			{
+				const auto name = "c" + std::to_string(m_namesByInitializer.size());
+				m_declarations << "constexpr auto " << name << " = " << initializer.str() << ";\n";
+				iter = m_namesByInitializer.emplace(initializer.str(), name).first;
+				UseBuiltins(node);
+			}
+			m_context.constantNames.emplace(&node, iter->second);
+			return true;
+		}
+
+		void UseBuiltin(Symbol name)
+		{
+			const auto& nameString = SymbolTable::GetName(name);
+			for (auto&& builtin : BuiltinDefinitions)
+			{
+				if (nameString == builtin.name && std::find(m_usedBuiltins.begin(), m_usedBuiltins.end(), &builtin) == m_usedBuiltins.end())
+					m_usedBuiltins.push_back(&builtin);
+			}
+		}
+
+		// References are skipped: their target is a constant too, so it or an enclosing call gets here by itself
+		void UseBuiltins(const CppAst::CallExpressionNode& node)
+		{
+			using namespace CppAst;
+
+			std::vector<const CallExpressionNode*> stack{ &node };
+			while (!stack.empty())
+			{
+				auto call = stack.back();
+				stack.pop_back();
+
+				UseBuiltin(call->callee->name);
+				for (auto&& param : call->params)
+				{
+					if (auto paramCall = AsNodePtr<const CallExpressionNode*>(param))
+						stack.push_back(paramCall);
+				}
+			}
+		}
+
+		CodeGenContext& m_context;
+		std::ostream& m_declarations;
+		CodeEmitter m_emitter;
+		std::vector<const BuiltinDefinition*> m_usedBuiltins;
+		std::unordered_map<std::string, std::string> m_namesByInitializer;
+		std::unordered_map<const CppAst::CallExpressionNode*, int> m_values; // Calls that are constant expressions
+	};
+} // namespace impl
+
+std::string GenerateCppCode(const CppAst::NodeUniquePtr& cppAst, const CodeGenOptions& options)
+{
+	std::stringstream sstream;
+	GenerateCppCode(cppAst, options, sstream);
+	return sstream.str();
+}
+
+void GenerateCppCode(const CppAst::NodeUniquePtr& cppAst, const CodeGenOptions& options, std::ostream& sstream)
+{
+	impl::CodeGenContext context;
+
+	if (options.constexprBuiltins)
+	{
+		std::ostringstream declarations;
+		impl::ConstantCollector collector(context, declarations);
+		collector.Collect(cppAst);
+
+		if (!collector.GetUsedBuiltins().empty())
+		{
+			sstream << "#include <initializer_list>\n\n";
+			for (auto&& builtin : collector.GetUsedBuiltins())
+				sstream << builtin->definition << '\n';
+			if (declarations.tellp() > 0)
+				sstream << declarations.str() << '\n';
+		}
+	}
+
+	impl::CodeEmitter(context).Emit(cppAst.get(), sstream);
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <ostream>
+#include <cassert>
+#include "symbol_table.h"
+#include "small_vector.h"
+
+struct Token
+{
+	enum class Type { Paren, Name, Number };
+	Type type;
+	std::string value; // Paren and Number tokens
+	Symbol name = SymbolTable::InvalidSymbol; // Name tokens
+};
+
+std::vector<Token> Tokenize(const std::string text);
+
+// Replaces the contents of tokens, reusing its capacity
+void Tokenize(const std::string& text, std::vector<Token>& tokens);
+
+namespace CommonAst
+{
+	// Storage for nodes and their parameter lists is recycled through per-thread free lists instead of going back to
+	// the heap, so once a thread has compiled a program, compiling another one of similar size barely allocates
+	struct NodeAllocator
+	{
+		static void* Allocate(size_t size);
+		static void Free(void* p, size_t size);
+
+		// Frees the calling thread's recycled blocks beyond maxPooledBytes, so a thread that once compiled a huge
+		// program doesn't keep its peak node count for the rest of the process
+		static void Trim(size_t maxPooledBytes);
+		static size_t PooledBytes();
+	};
+
+	struct Node
+	{
+		virtual ~Node() = default;
+
+		static void* operator new(size_t size) { return NodeAllocator::Allocate(size); }
+		static void operator delete(void* p, size_t size) { NodeAllocator::Free(p, size); }
+	};
+
+	using NodeUniquePtr = std::unique_ptr<Node>;
+
+	// A call parameter: either an integer literal stored inline, or an owned child node. Literals are tagged in the low
+	// bit, which is always clear in node pointers, so they take neither a node allocation nor an indirection.
+	class Param
+	{
+	public:
+		Param() = default;
+
+		template <typename NodeType>
+		Param(std::unique_ptr<NodeType> node) : m_bits(reinterpret_cast<uintptr_t>(static_cast<Node*>(node.release()))) {}
+
+		static Param Literal(int value)
+		{
+			Param param;
+			param.m_bits = (static_cast<uint64_t>(static_cast<uint32_t>(value)) << 1) | 1;
+			return param;
+		}
+
+		Param(Param&& other) : m_bits(other.m_bits) { other.m_bits = 0; }
+
+		Param& operator=(Param&& other)
+		{
+			if (this != &other)
+			{
+				Reset();
+				m_bits = other.m_bits;
+				other.m_bits = 0;
+			}
+			return *this;
+		}
+
+		Param(const Param&) = delete;
+		Param& operator=(const Param&) = delete;
+
+		~Param() { Reset(); }
+
+		bool IsLiteral() const { return (m_bits & 1) != 0; }
+		int GetLiteral() const { assert(IsLiteral()); return static_cast<int>(static_cast<uint32_t>(m_bits >> 1)); }
+
+		// Null for literals
+		Node* GetNode() const { return IsLiteral() ? nullptr : reinterpret_cast<Node*>(static_cast<uintptr_t>(m_bits)); }
+
+		NodeUniquePtr ReleaseNode()
+		{
+			assert(!IsLiteral());
+			NodeUniquePtr node(GetNode());
+			m_bits = 0;
+			return node;
+		}
+
+	private:
+		void Reset()
+		{
+			delete GetNode();
+			m_bits = 0;
+		}
+
+		uint64_t m_bits = 0; // 64 bits even on 32-bit targets, so that any int fits next to the tag
+	};
+
+	// Call parameters: nearly all calls have at most 3, which then live inside the call node without another allocation
+	using ParamList = SmallVector<Param, 3, NodeAllocator>;
+
+	template <typename NodeType>
+	NodeType* GetNodePtr(const std::unique_ptr<NodeType>& node) { return node.get(); }
+
+	template <typename NodeType>
+	NodeType* GetNodePtr(NodeType* node) { return node; }
+
+	// Null for literals, so matching a literal parameter against any node type fails
+	inline Node* GetNodePtr(const Param& param) { return param.GetNode(); }
+
+	// Destroys the nodes in params without recursing into their subtrees: nodes are queued and deleted one at a time by
+	// the outermost call, so tearing down a tree of any depth takes heap space rather than stack space. Call nodes
+	// call this from their destructors.
+	void DestroyParams(ParamList& params);
+
+	// Works on both owning and raw node pointers
+	template <typename TargetNodeType, typename NodeType>
+	auto AsNodePtr(NodeType&& node)
+	{
+		return dynamic_cast<TargetNodeType>(GetNodePtr(node));
+	}
+}
+
+namespace LispAst
+{
+	using namespace CommonAst;
+
+	struct ProgramNode : Node
+	{
+		std::string name;
+		std::vector<NodeUniquePtr> body;
+	};
+
+	struct CallExpressionNode : Node
+	{
+		Symbol name = SymbolTable::InvalidSymbol;
+		ParamList params;
+		bool shared = false; // Referenced by CallExpressionRefNodes elsewhere in the tree
+
+		~CallExpressionNode() { DestroyParams(params); }
+	};
+
+	// Only stands alone as a top-level form that constant folding reduced; literal call parameters are stored inline
+	// (see Param)
+	struct NumberLiteralNode : Node
+	{
+		int value;
+		NumberLiteralNode(int v) : value(v) {}
+	};
+
+	// Stands in for a call structurally identical to target, which appears earlier in the tree and owns the subtree
+	struct CallExpressionRefNode : Node
+	{
+		const CallExpressionNode* target;
+		CallExpressionRefNode(const CallExpressionNode* target) : target(target) {}
+	};
+
+	struct ParseOptions
+	{
+		// Deduplicate structurally identical nested calls, turning the tree into a DAG of CallExpressionRefNodes
+		bool hashCons = false;
+	};
+
+	NodeUniquePtr Parse(const std::vector<Token>& tokens, const ParseOptions& options = ParseOptions());
+
+	// Visit does not descend through CallExpressionRefNodes; the shared subtree is visited once, where it is owned. Nodes
+	// are visited in depth-first order from an explicit stack, so deep trees can't overflow the call stack.
+	struct Visitor
+	{
+		virtual void OnVisit(const ProgramNode& program, int depth) {}
+		virtual void OnVisit(const CallExpressionNode& callExpression, const Node& parent, int depth) {}
+		virtual void OnVisit(const NumberLiteralNode& numberLiteral, const Node& parent, int depth) {}
+		virtual void OnVisit(const CallExpressionRefNode& callExpressionRef, const Node& parent, int depth) {}
+
+		// Literal call parameters aren't nodes; by default they are visited as a temporary NumberLiteralNode
+		virtual void OnVisitLiteral(int value, const CallExpressionNode& parent, int depth) { OnVisit(NumberLiteralNode(value), parent, depth); }
+	};
+
+	void Visit(const NodeUniquePtr& rootNode, const Node* parent, Visitor& visitor, int depth = 0);
+
+	void PrintAst(const NodeUniquePtr& lispAst, std::ostream& os);
+} // namespace LispAst
+
+namespace CppAst
+{
+	using namespace CommonAst;
+
+	struct ProgramNode : Node
+	{
+		std::string name;
+		std::vector<NodeUniquePtr> body;
+	};
+
+	struct IdentifierNode : Node
+	{
+		Symbol name;
+		IdentifierNode(Symbol name) : name(name) {}
+	};
+
+	// Only used as the expression of a statement that constant folding reduced; literal call parameters are stored
+	// inline (see Param)
+	struct NumberLiteralNode : Node
+	{
+		int value;
+		NumberLiteralNode(int v) : value(v) {}
+	};
+
+	struct CallExpressionNode : Node
+	{
+		//NodeUniquePtr callee;
+		std::unique_ptr<IdentifierNode> callee;
+		ParamList params;
+		bool shared = false; // Referenced by CallExpressionRefNodes elsewhere in the tree
+
+		~CallExpressionNode() { DestroyParams(params); }
+	};
+
+	struct CallExpressionRefNode : Node
+	{
+		const CallExpressionNode* target;
+		CallExpressionRefNode(const CallExpressionNode* target) : target(target) {}
+	};
+
+	struct ExpressionStatementNode : Node
+	{
+		NodeUniquePtr expression; // A CallExpressionNode, or a NumberLiteralNode if constant folding reduced the call
+	};
+
+	// 'const auto name = initializer;', introduced by common-subexpression elimination
+	struct VariableDeclarationNode : Node
+	{
+		std::unique_ptr<IdentifierNode> name;
+		NodeUniquePtr initializer;
+	};
+
+	void PrintAst(const NodeUniquePtr& cppAst, std::ostream& os);
+} // namespace CppAst
+
+CppAst::NodeUniquePtr TransformLispAstToCppAst(const LispAst::NodeUniquePtr& lispAst);
+
+// Same as above, but consumes lispAst: its storage is reused for the Cpp AST and each Lisp node is freed as soon as it
+// is lowered, so both trees are never fully in memory at once
+CppAst::NodeUniquePtr TransformLispAstToCppAst(LispAst::NodeUniquePtr&& lispAst);
+
+struct CodeGenOptions
+{
+	// Emits constexpr definitions of the known builtins (add, subtract, multiply) before main, and computes each call
+	// to them with only literal arguments in a namespace-scope constexpr variable, so the downstream compiler
+	// evaluates it at compile time
+	bool constexprBuiltins = false;
+};
+
+std::string GenerateCppCode(const CppAst::NodeUniquePtr& cppAst, const CodeGenOptions& options = CodeGenOptions());
+void GenerateCppCode(const CppAst::NodeUniquePtr& cppAst, const CodeGenOptions& options, std::ostream& os);
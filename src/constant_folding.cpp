@@ -0,0 +1,240 @@
+#include "constant_folding.h"
+#include <limits>
+#include <vector>
+
+namespace ConstantFolding
+{
+	namespace
+	{
+		bool FitsInInt(long long value)
+		{
+			return value >= std::numeric_limits<int>::min() && value <= std::numeric_limits<int>::max();
+		}
+
+		// Intermediate results are checked after every step, so a long long never overflows
+		bool Add(const int* args, size_t numArgs, int& result)
+		{
+			long long sum = 0;
+			for (size_t i = 0; i < numArgs; ++i)
+			{
+				sum += args[i];
+				if (!FitsInInt(sum))
+					return false;
+			}
+			result = static_cast<int>(sum);
+			return true;
+		}
+
+		bool Subtract(const int* args, size_t numArgs, int& result)
+		{
+			if (numArgs == 0)
+				return false;
+			long long difference = numArgs == 1 ? -static_cast<long long>(args[0]) : args[0];
+			for (size_t i = 1; i < numArgs; ++i)
+			{
+				difference -= args[i];
+				if (!FitsInInt(difference))
+					return false;
+			}
+			if (!FitsInInt(difference))
+				return false;
+			result = static_cast<int>(difference);
+			return true;
+		}
+
+		bool Multiply(const int* args, size_t numArgs, int& result)
+		{
+			long long product = 1;
+			for (size_t i = 0; i < numArgs; ++i)
+			{
+				product *= args[i];
+				if (!FitsInInt(product))
+					return false;
+			}
+			result = static_cast<int>(product);
+			return true;
+		}
+
+		struct KnownBuiltin
+		{
+			const char* name;
+			BuiltinFunction function;
+		};
+
+		const KnownBuiltin KnownBuiltins[] =
+		{
+			{ "add", Add },
+			{ "subtract", Subtract },
+			{ "multiply", Multiply },
+		};
+
+		class Folder
+		{
+		public:
+			explicit Folder(const Options& options) : m_options(options) {}
+
+			void Fold(LispAst::NodeUniquePtr& node)
+			{
+				using namespace LispAst;
+
+				if (auto program = AsNodePtr<ProgramNode*>(node))
+				{
+					for (auto&& bodyNode : program->body)
+					{
+						// A top-level form stays a node, so it becomes a NumberLiteralNode
+						int value;
+						if (Fold(bodyNode.get(), value))
+						{
+							Retire(std::move(bodyNode));
+							bodyNode = std::make_unique<NumberLiteralNode>(value);
+						}
+					}
+				}
+			}
+
+			const Result& GetResult() const { return m_result; }
+
+		private:
+			// Folds the calls under node, then returns whether node itself reduces to a literal: a call to a builtin
+			// whose arguments all did, or a reference to such a call. Calls are folded bottom-up from an explicit
+			// stack, so nesting depth is only limited by memory.
+			bool Fold(LispAst::Node* node, int& value)
+			{
+				using namespace LispAst;
+
+				if (auto ref = AsNodePtr<CallExpressionRefNode*>(node))
+					return FindFoldedValue(*ref, value);
+
+				auto root = AsNodePtr<CallExpressionNode*>(node);
+				if (!root)
+					return false;
+
+				// Calls whose parameters are being folded, innermost last
+				struct Frame
+				{
+					CallExpressionNode* call;
+					size_t nextParam;
+				};
+				std::vector<Frame> frames{ Frame{ root, 0 } };
+				while (true)
+				{
+					auto& frame = frames.back();
+					if (frame.nextParam < frame.call->params.size())
+					{
+						auto&& param = frame.call->params[frame.nextParam++];
+						int paramValue;
+						if (auto call = AsNodePtr<CallExpressionNode*>(param))
+							frames.push_back(Frame{ call, 0 });
+						else if (auto paramRef = AsNodePtr<CallExpressionRefNode*>(param))
+						{
+							if (FindFoldedValue(*paramRef, paramValue))
+								ReplaceWithLiteral(param, paramValue);
+						}
+						continue;
+					}
+
+					auto call = frame.call;
+					frames.pop_back();
+
+					int callValue;
+					const bool folded = Evaluate(*call, callValue);
+					if (folded)
+					{
+						++m_result.callsFolded;
+						if (call->shared)
+							m_foldedSharedCalls.emplace(call, callValue);
+					}
+
+					if (frames.empty())
+					{
+						value = callValue;
+						return folded;
+					}
+					if (folded)
+						ReplaceWithLiteral(frames.back().call->params[frames.back().nextParam - 1], callValue);
+				}
+			}
+
+			// The target precedes its references, so it has already been folded if it could be
+			bool FindFoldedValue(const LispAst::CallExpressionRefNode& ref, int& value) const
+			{
+				auto iter = m_foldedSharedCalls.find(ref.target);
+				if (iter == m_foldedSharedCalls.end())
+					return false;
+				value = iter->second;
+				return true;
+			}
+
+			// Parameters become inline literals, so the node disappears
+			void ReplaceWithLiteral(CommonAst::Param& param, int value)
+			{
+				Retire(param.ReleaseNode());
+				param = CommonAst::Param::Literal(value);
+				++m_result.nodesEliminated;
+			}
+
+			// References to a shared call point at it, so keep it alive
+			void Retire(LispAst::NodeUniquePtr node)
+			{
+				auto call = CommonAst::AsNodePtr<const LispAst::CallExpressionNode*>(node);
+				if (call && call->shared)
+					m_retiredNodes.push_back(std::move(node));
+			}
+
+			bool Evaluate(const LispAst::CallExpressionNode& call, int& value)
+			{
+				auto builtin = m_options.builtins.find(call.name);
+				if (builtin == m_options.builtins.end())
+					return false;
+
+				m_args.clear();
+				for (auto&& param : call.params)
+				{
+					if (!param.IsLiteral())
+						return false;
+					m_args.push_back(param.GetLiteral());
+				}
+				return builtin->second(m_args.data(), m_args.size(), value);
+			}
+
+			const Options& m_options;
+			Result m_result;
+			std::vector<int> m_args;
+			std::unordered_map<const LispAst::CallExpressionNode*, int> m_foldedSharedCalls;
+			std::vector<LispAst::NodeUniquePtr> m_retiredNodes;
+		};
+	}
+
+	BuiltinFunction FindKnownBuiltin(const std::string& name)
+	{
+		for (auto&& builtin : KnownBuiltins)
+		{
+			if (name == builtin.name)
+				return builtin.function;
+		}
+		return nullptr;
+	}
+
+	std::vector<std::string> GetKnownBuiltinNames()
+	{
+		std::vector<std::string> names;
+		for (auto&& builtin : KnownBuiltins)
+			names.push_back(builtin.name);
+		return names;
+	}
+
+	Options Options::Default()
+	{
+		Options options;
+		for (auto&& builtin : KnownBuiltins)
+			options.Add(builtin.name, builtin.function);
+		return options;
+	}
+
+	Result FoldConstants(LispAst::NodeUniquePtr& lispAst, const Options& options)
+	{
+		Folder folder(options);
+		folder.Fold(lispAst);
+		return folder.GetResult();
+	}
+}
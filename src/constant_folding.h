@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "compiler.h"
+
+// Lisp AST pass that evaluates calls to pure builtins whose arguments are all literals, replacing each such call with
+// a literal parameter (or a NumberLiteralNode at the top level)
+namespace ConstantFolding
+{
+	// Evaluates a builtin on literal arguments. Returns false if the call can't be folded (wrong arity, overflow).
+	using BuiltinFunction = bool (*)(const int* args, size_t numArgs, int& result);
+
+	// Builtins this pass has implementations for: add, subtract and multiply
+	BuiltinFunction FindKnownBuiltin(const std::string& name);
+	std::vector<std::string> GetKnownBuiltinNames();
+
+	struct Options
+	{
+		std::unordered_map<Symbol, BuiltinFunction> builtins;
+
+		void Add(const std::string& name, BuiltinFunction function) { builtins[SymbolTable::Intern(name)] = function; }
+
+		// All known builtins
+		static Options Default();
+	};
+
+	struct Result
+	{
+		size_t callsFolded = 0;
+		size_t nodesEliminated = 0;
+	};
+
+	Result FoldConstants(LispAst::NodeUniquePtr& lispAst, const Options& options);
+}
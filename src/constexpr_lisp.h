@@ -0,0 +1,352 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+// A tokenizer, parser and evaluator for small embedded Lisp snippets that also run in constant expressions. They work
+// over fixed-capacity arrays instead of std::string, std::vector and heap-allocated nodes, so a snippet used to
+// initialize a constexpr variable is evaluated entirely while compiling the C++ code that embeds it:
+//
+//     using namespace ConstexprLisp::Literals;
+//     constexpr auto four = "(add 2 (subtract 4 2))"_lisp;
+//
+// Only the default builtins (add, subtract, multiply) can be called, with the same wrapping 64-bit arithmetic as
+// Interpreter::Builtins. Errors throw the same exceptions as the runtime pipeline; during constant evaluation, a throw
+// is a compile error pointing at the offending check.
+namespace ConstexprLisp
+{
+	using Value = int64_t; // Same as Interpreter::Value
+
+	// Default number of tokens, instructions and values a snippet may need; exceeding it throws std::length_error
+	const size_t DefaultCapacity = 256;
+
+	template <typename T, size_t Capacity>
+	class FixedVector
+	{
+	public:
+		constexpr size_t size() const { return m_size; }
+		constexpr bool empty() const { return m_size == 0; }
+
+		constexpr T& operator[](size_t index) { return m_items[index]; }
+		constexpr const T& operator[](size_t index) const { return m_items[index]; }
+
+		constexpr T& back() { return m_items[m_size - 1]; }
+		constexpr const T* data() const { return m_items; }
+
+		constexpr void push_back(const T& item)
+		{
+			if (m_size == Capacity)
+				throw std::length_error("Lisp snippet exceeds the capacity of ConstexprLisp");
+			m_items[m_size++] = item;
+		}
+
+		constexpr void pop_back() { --m_size; }
+
+	private:
+		T m_items[Capacity] = {};
+		size_t m_size = 0;
+	};
+
+	struct Token
+	{
+		enum class Type { OpenParen, CloseParen, Name, Number };
+		Type type = Type::OpenParen;
+		size_t begin = 0; // Offset of the token's text in the source
+		size_t size = 0;
+	};
+
+	enum class Builtin { Add, Subtract, Multiply };
+
+	// A program is compiled to instructions for a stack machine, like Bytecode::Program
+	struct Instruction
+	{
+		enum class OpCode { PushInt, CallBuiltin, StoreResult };
+		OpCode opCode = OpCode::PushInt;
+		Value value = 0;				// PushInt
+		Builtin builtin = Builtin::Add;	// CallBuiltin
+		size_t numArgs = 0;				// CallBuiltin
+	};
+
+	template <size_t Capacity>
+	struct Program
+	{
+		FixedVector<Instruction, Capacity> code;
+		size_t numResults = 0;
+	};
+
+	namespace Detail
+	{
+		constexpr bool IsAlpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+		constexpr bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+		constexpr bool NameEquals(const char* source, const Token& token, const char* name)
+		{
+			size_t i = 0;
+			for (; i < token.size; ++i)
+			{
+				if (name[i] != source[token.begin + i])
+					return false;
+			}
+			return name[i] == '\0';
+		}
+
+		constexpr Builtin FindBuiltin(const char* source, const Token& token)
+		{
+			if (NameEquals(source, token, "add"))
+				return Builtin::Add;
+			if (NameEquals(source, token, "subtract"))
+				return Builtin::Subtract;
+			if (NameEquals(source, token, "multiply"))
+				return Builtin::Multiply;
+			throw std::runtime_error("Unknown function in Lisp snippet");
+		}
+
+		// Parsed as an int, like the runtime parser does
+		constexpr Value ParseNumber(const char* source, const Token& token)
+		{
+			Value value = 0;
+			for (size_t i = 0; i < token.size; ++i)
+			{
+				value = value * 10 + (source[token.begin + i] - '0');
+				if (value > std::numeric_limits<int>::max())
+					throw std::out_of_range("Number out of range in Lisp snippet");
+			}
+			return value;
+		}
+
+		// A call whose arguments are being compiled
+		struct OpenCall
+		{
+			Builtin builtin = Builtin::Add;
+			size_t numArgs = 0;
+		};
+
+		// Opens the call whose '(' was just consumed; no lambdas, as they can't be constexpr before C++17
+		template <size_t Capacity>
+		constexpr void Open(const char* source, const FixedVector<Token, Capacity>& tokens, size_t& i, FixedVector<OpenCall, Capacity>& openCalls)
+		{
+			if (i == tokens.size() || tokens[i].type != Token::Type::Name)
+				throw std::logic_error("Expecting function name immediately after '('");
+			OpenCall call;
+			call.builtin = FindBuiltin(source, tokens[i++]);
+			openCalls.push_back(call);
+		}
+
+		// Unsigned arithmetic, so overflow wraps instead of being undefined
+		constexpr Value CallBuiltin(Builtin builtin, const Value* args, size_t numArgs)
+		{
+			uint64_t result = 0;
+			switch (builtin)
+			{
+			case Builtin::Add:
+				for (size_t i = 0; i < numArgs; ++i)
+					result += static_cast<uint64_t>(args[i]);
+				break;
+			case Builtin::Subtract:
+				if (numArgs == 0)
+					throw std::runtime_error("subtract expects at least one argument");
+				result = numArgs == 1 ? 0 - static_cast<uint64_t>(args[0]) : static_cast<uint64_t>(args[0]);
+				for (size_t i = 1; i < numArgs; ++i)
+					result -= static_cast<uint64_t>(args[i]);
+				break;
+			case Builtin::Multiply:
+				result = 1;
+				for (size_t i = 0; i < numArgs; ++i)
+					result *= static_cast<uint64_t>(args[i]);
+				break;
+			}
+			return static_cast<Value>(result);
+		}
+	}
+
+	template <size_t Capacity = DefaultCapacity>
+	constexpr FixedVector<Token, Capacity> Tokenize(const char* source, size_t size)
+	{
+		FixedVector<Token, Capacity> tokens;
+		size_t i = 0;
+		while (i < size)
+		{
+			const char c = source[i];
+			Token token;
+			token.begin = i;
+			if (c == ' ' || c == '\t' || c == '\n')
+			{
+				++i;
+				continue;
+			}
+			else if (c == '(' || c == ')')
+			{
+				token.type = c == '(' ? Token::Type::OpenParen : Token::Type::CloseParen;
+				++i;
+			}
+			else if (Detail::IsAlpha(c))
+			{
+				token.type = Token::Type::Name;
+				while (i < size && Detail::IsAlpha(source[i]))
+					++i;
+			}
+			else if (Detail::IsDigit(c))
+			{
+				token.type = Token::Type::Number;
+				while (i < size && Detail::IsDigit(source[i]))
+					++i;
+			}
+			else
+			{
+				throw std::logic_error("Unexpected character");
+			}
+			token.size = i - token.begin;
+			tokens.push_back(token);
+		}
+		return tokens;
+	}
+
+	// Tokenizes and parses source, compiling each top-level form as it is parsed. Open calls are kept on a fixed
+	// stack, as in LispAst::Parse, and the error checks are the same.
+	template <size_t Capacity = DefaultCapacity>
+	constexpr Program<Capacity> Compile(const char* source, size_t size)
+	{
+		const auto tokens = Tokenize<Capacity>(source, size);
+		FixedVector<Detail::OpenCall, Capacity> openCalls;
+
+		Program<Capacity> program;
+		size_t i = 0;
+		while (i < tokens.size())
+		{
+			if (tokens[i++].type != Token::Type::OpenParen)
+				throw std::logic_error("Program must start with '('");
+			Detail::Open(source, tokens, i, openCalls);
+
+			while (!openCalls.empty())
+			{
+				if (i == tokens.size())
+					throw std::logic_error("Missing ')' to end call expression");
+
+				const auto& token = tokens[i++];
+				Instruction instruction;
+				switch (token.type)
+				{
+				case Token::Type::OpenParen:
+					Detail::Open(source, tokens, i, openCalls);
+					continue;
+
+				case Token::Type::CloseParen:
+					instruction.opCode = Instruction::OpCode::CallBuiltin;
+					instruction.builtin = openCalls.back().builtin;
+					instruction.numArgs = openCalls.back().numArgs;
+					openCalls.pop_back();
+					break;
+
+				case Token::Type::Name:
+					throw std::logic_error("Unexpected name token in argument list");
+
+				case Token::Type::Number:
+					instruction.opCode = Instruction::OpCode::PushInt;
+					instruction.value = Detail::ParseNumber(source, token);
+					break;
+				}
+
+				program.code.push_back(instruction);
+				if (!openCalls.empty())
+					++openCalls.back().numArgs;
+			}
+
+			Instruction store;
+			store.opCode = Instruction::OpCode::StoreResult;
+			program.code.push_back(store);
+			++program.numResults;
+		}
+		return program;
+	}
+
+	// Returns the value of each top-level form
+	template <size_t Capacity>
+	constexpr FixedVector<Value, Capacity> Evaluate(const Program<Capacity>& program)
+	{
+		FixedVector<Value, Capacity> stack;
+		FixedVector<Value, Capacity> results;
+		for (size_t i = 0; i < program.code.size(); ++i)
+		{
+			const auto& instruction = program.code[i];
+			switch (instruction.opCode)
+			{
+			case Instruction::OpCode::PushInt:
+				stack.push_back(instruction.value);
+				break;
+
+			case Instruction::OpCode::CallBuiltin:
+			{
+				const auto base = stack.size() - instruction.numArgs;
+				const auto result = Detail::CallBuiltin(instruction.builtin, stack.data() + base, instruction.numArgs);
+				while (stack.size() > base)
+					stack.pop_back();
+				stack.push_back(result);
+				break;
+			}
+
+			case Instruction::OpCode::StoreResult:
+				results.push_back(stack.back());
+				stack.pop_back();
+				break;
+			}
+		}
+		return results;
+	}
+
+	// Returns the value of the last top-level form; throws std::logic_error if there is none
+	template <size_t Capacity = DefaultCapacity>
+	constexpr Value Evaluate(const char* source, size_t size)
+	{
+		const auto results = Evaluate(Compile<Capacity>(source, size));
+		if (results.empty())
+			throw std::logic_error("Lisp snippet has no form to evaluate");
+		return results[results.size() - 1];
+	}
+
+	template <size_t Capacity = DefaultCapacity, size_t N>
+	constexpr Value Evaluate(const char (&source)[N])
+	{
+		return Evaluate<Capacity>(source, N - 1);
+	}
+
+#if __cplusplus >= 202002L && defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+
+	// Holds a string literal as a template argument
+	template <size_t N>
+	struct FixedString
+	{
+		char chars[N] = {};
+
+		constexpr FixedString(const char (&s)[N])
+		{
+			for (size_t i = 0; i < N; ++i)
+				chars[i] = s[i];
+		}
+	};
+
+	inline namespace Literals
+	{
+		// consteval, so the snippet is always evaluated while compiling, sized to fit however long it is
+		template <FixedString Source>
+		consteval Value operator""_lisp()
+		{
+			return Evaluate<sizeof(Source.chars)>(Source.chars, sizeof(Source.chars) - 1);
+		}
+	}
+
+#else
+
+	inline namespace Literals
+	{
+		// Evaluated while compiling when used in a constant expression, such as the initializer of a constexpr
+		// variable; build as C++20 (TINYCOMPILER_CXX20) to guarantee it. Snippets are limited to DefaultCapacity.
+		constexpr Value operator""_lisp(const char* source, size_t size)
+		{
+			return Evaluate(source, size);
+		}
+	}
+
+#endif
+}
@@ -0,0 +1,171 @@
+#include "interpreter.h"
+#include <stdexcept>
+#include <vector>
+
+namespace Interpreter
+{
+	namespace Builtins
+	{
+		// Unsigned arithmetic, so overflow wraps instead of being undefined
+		Value Add(void*, const Value* args, size_t numArgs)
+		{
+			uint64_t sum = 0;
+			for (size_t i = 0; i < numArgs; ++i)
+				sum += static_cast<uint64_t>(args[i]);
+			return static_cast<Value>(sum);
+		}
+
+		Value Subtract(void*, const Value* args, size_t numArgs)
+		{
+			if (numArgs == 0)
+				throw std::runtime_error("subtract expects at least one argument");
+			if (numArgs == 1)
+				return static_cast<Value>(0 - static_cast<uint64_t>(args[0]));
+			uint64_t difference = static_cast<uint64_t>(args[0]);
+			for (size_t i = 1; i < numArgs; ++i)
+				difference -= static_cast<uint64_t>(args[i]);
+			return static_cast<Value>(difference);
+		}
+
+		Value Multiply(void*, const Value* args, size_t numArgs)
+		{
+			uint64_t product = 1;
+			for (size_t i = 0; i < numArgs; ++i)
+				product *= static_cast<uint64_t>(args[i]);
+			return static_cast<Value>(product);
+		}
+	}
+
+	namespace
+	{
+		class Evaluator
+		{
+		public:
+			explicit Evaluator(const NativeRegistry& natives) : m_natives(natives) {}
+
+			Value Evaluate(const CommonAst::Param& param)
+			{
+				return param.IsLiteral() ? param.GetLiteral() : Evaluate(param.GetNode());
+			}
+
+			Value Evaluate(const LispAst::Node* node)
+			{
+				using namespace LispAst;
+
+				if (auto literal = AsNodePtr<const NumberLiteralNode*>(node))
+					return literal->value;
+				else if (auto call = AsNodePtr<const CallExpressionNode*>(node))
+					return EvaluateCall(*call);
+				else if (auto ref = AsNodePtr<const CallExpressionRefNode*>(node))
+					return EvaluateCall(*ref->target); // Natives may have side effects, so shared calls still run each time
+
+				assert(false && "Unhandled node type");
+				return 0;
+			}
+
+		private:
+			// Calls are evaluated from an explicit stack of frames rather than by recursion, so nesting depth is only
+			// limited by memory. Arguments of nested calls are pushed above ours and popped before we read ours.
+			Value EvaluateCall(const LispAst::CallExpressionNode& rootCall)
+			{
+				using namespace LispAst;
+
+				m_frames.clear();
+				PushFrame(rootCall);
+				while (true)
+				{
+					auto& frame = m_frames.back();
+					if (frame.nextParam < frame.call->params.size())
+					{
+						auto&& param = frame.call->params[frame.nextParam++];
+						if (param.IsLiteral())
+							m_args.push_back(param.GetLiteral());
+						else if (auto call = AsNodePtr<const CallExpressionNode*>(param))
+							PushFrame(*call);
+						else if (auto ref = AsNodePtr<const CallExpressionRefNode*>(param))
+							PushFrame(*ref->target); // Natives may have side effects, so shared calls still run each time
+						else
+							m_args.push_back(Evaluate(param.GetNode()));
+						continue;
+					}
+
+					auto&& entry = m_natives.GetEntry(frame.id);
+					const auto result = entry.function(entry.userData, m_args.data() + frame.base, frame.call->params.size());
+					m_args.resize(frame.base);
+					m_frames.pop_back();
+
+					if (m_frames.empty())
+						return result;
+					m_args.push_back(result);
+				}
+			}
+
+			void PushFrame(const LispAst::CallExpressionNode& call)
+			{
+				const auto id = m_natives.FindId(call.name);
+				if (id == NativeRegistry::InvalidId)
+					throw std::runtime_error("Unknown function '" + SymbolTable::GetName(call.name) + "'");
+				m_frames.push_back(Frame{ &call, 0, id, m_args.size() });
+			}
+
+			struct Frame
+			{
+				const LispAst::CallExpressionNode* call;
+				size_t nextParam;
+				size_t id;
+				size_t base; // Index of the call's first argument in m_args
+			};
+
+			const NativeRegistry& m_natives;
+			std::vector<Value> m_args;
+			std::vector<Frame> m_frames;
+		};
+	}
+
+	size_t NativeRegistry::Register(const std::string& name, NativeFunction function, void* userData)
+	{
+		const auto symbol = SymbolTable::Intern(name);
+		auto iter = m_ids.find(symbol);
+		if (iter != m_ids.end())
+		{
+			m_entries[iter->second] = Entry{ symbol, function, userData };
+			return iter->second;
+		}
+
+		m_entries.push_back(Entry{ symbol, function, userData });
+		m_ids.emplace(symbol, m_entries.size() - 1);
+		return m_entries.size() - 1;
+	}
+
+	size_t NativeRegistry::FindId(Symbol name) const
+	{
+		auto iter = m_ids.find(name);
+		return iter != m_ids.end() ? iter->second : InvalidId;
+	}
+
+	const NativeRegistry& NativeRegistry::Default()
+	{
+		static const NativeRegistry registry = []
+		{
+			NativeRegistry r;
+			r.Register("add", Builtins::Add);
+			r.Register("subtract", Builtins::Subtract);
+			r.Register("multiply", Builtins::Multiply);
+			return r;
+		}();
+		return registry;
+	}
+
+	std::vector<Value> Evaluate(const LispAst::NodeUniquePtr& lispAst, const NativeRegistry& natives)
+	{
+		auto program = CommonAst::AsNodePtr<const LispAst::ProgramNode*>(lispAst);
+		assert(program);
+
+		Evaluator evaluator(natives);
+		std::vector<Value> results;
+		results.reserve(program->body.size());
+		for (auto&& bodyNode : program->body)
+			results.push_back(evaluator.Evaluate(bodyNode.get()));
+		return results;
+	}
+}
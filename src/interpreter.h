@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "compiler.h"
+
+// Evaluates a Lisp program directly, calling native C++ functions instead of generating code
+namespace Interpreter
+{
+	// Integer arithmetic wraps around on overflow
+	using Value = int64_t;
+
+	// Native functions may throw std::runtime_error to report errors such as wrong arity
+	using NativeFunction = Value (*)(void* userData, const Value* args, size_t numArgs);
+
+	// The default natives, exposed so compiling backends can recognize calls to them and inline them
+	namespace Builtins
+	{
+		Value Add(void* userData, const Value* args, size_t numArgs);
+		Value Subtract(void* userData, const Value* args, size_t numArgs); // Negates a single argument
+		Value Multiply(void* userData, const Value* args, size_t numArgs);
+	}
+
+	class NativeRegistry
+	{
+	public:
+		struct Entry
+		{
+			Symbol name;
+			NativeFunction function;
+			void* userData;
+		};
+
+		static const size_t InvalidId = static_cast<size_t>(-1);
+
+		// Registers function under name, replacing any previous registration. Returns its id.
+		size_t Register(const std::string& name, NativeFunction function, void* userData = nullptr);
+
+		size_t FindId(Symbol name) const;
+		const Entry& GetEntry(size_t id) const { return m_entries[id]; }
+		size_t Size() const { return m_entries.size(); }
+
+		// add, subtract and multiply
+		static const NativeRegistry& Default();
+
+	private:
+		std::vector<Entry> m_entries;
+		std::unordered_map<Symbol, size_t> m_ids;
+	};
+
+	// Evaluates each top-level form in order, returning their values. Throws std::runtime_error on calls to functions
+	// that aren't registered.
+	std::vector<Value> Evaluate(const LispAst::NodeUniquePtr& lispAst, const NativeRegistry& natives);
+}
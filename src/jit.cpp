@@ -0,0 +1,454 @@
+#include "jit.h"
+#include <stdexcept>
+#include <exception>
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <unordered_map>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#include <unistd.h>
+#include <sys/mman.h>
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+namespace Jit
+{
+	using Interpreter::Value;
+	using Interpreter::NativeRegistry;
+
+	bool IsSupported()
+	{
+		return JIT_SUPPORTED != 0;
+	}
+
+	namespace
+	{
+		struct FrameNeeds
+		{
+			size_t nesting;	// Nested calls on the deepest path, counting those under references
+			size_t slots;	// Value stack slots, as the Compiler below assigns them at most
+		};
+
+		// Measured from an explicit stack, since the programs it guards against are the ones too deep to recurse into.
+		// A call's parameter i is compiled into its i-th slot or lower, so it needs at most i plus its own slots.
+		FrameNeeds MeasureFrame(const LispAst::ProgramNode& program)
+		{
+			using namespace LispAst;
+
+			struct Frame
+			{
+				const CallExpressionNode* call;
+				size_t nextParam;
+				FrameNeeds needs; // Of the parameters so far
+			};
+			std::vector<Frame> frames;
+			std::unordered_map<const CallExpressionNode*, FrameNeeds> sharedNeeds; // Targets precede their references
+
+			// Literals and number nodes take one slot
+			auto NeedsOf = [&](const Node* node)
+			{
+				if (auto ref = AsNodePtr<const CallExpressionRefNode*>(node))
+					return sharedNeeds[ref->target];
+				return FrameNeeds{ 0, 1 };
+			};
+
+			auto Combine = [](FrameNeeds& needs, const FrameNeeds& paramNeeds, size_t paramIndex)
+			{
+				needs.nesting = std::max(needs.nesting, paramNeeds.nesting);
+				needs.slots = std::max(needs.slots, paramIndex + paramNeeds.slots);
+			};
+
+			FrameNeeds programNeeds{ 0, 0 };
+			for (auto&& bodyNode : program.body)
+			{
+				auto root = AsNodePtr<const CallExpressionNode*>(bodyNode);
+				if (!root)
+				{
+					Combine(programNeeds, NeedsOf(bodyNode.get()), 0);
+					continue;
+				}
+
+				frames.push_back(Frame{ root, 0, FrameNeeds{ 0, 1 } });
+				while (!frames.empty())
+				{
+					auto& frame = frames.back();
+					if (frame.nextParam < frame.call->params.size())
+					{
+						auto&& param = frame.call->params[frame.nextParam++];
+						if (auto call = AsNodePtr<const CallExpressionNode*>(param))
+							frames.push_back(Frame{ call, 0, FrameNeeds{ 0, 1 } });
+						else
+							Combine(frame.needs, NeedsOf(param.GetNode()), frame.nextParam - 1);
+						continue;
+					}
+
+					auto needs = frame.needs;
+					++needs.nesting;
+					if (frame.call->shared)
+						sharedNeeds[frame.call] = needs;
+					frames.pop_back();
+
+					if (frames.empty())
+						Combine(programNeeds, needs, 0);
+					else
+						Combine(frames.back().needs, needs, frames.back().nextParam - 1);
+				}
+			}
+			return programNeeds;
+		}
+
+		bool FitsInFrame(const FrameNeeds& needs)
+		{
+			return needs.nesting <= MaxNestingDepth && needs.slots * sizeof(Value) <= MaxFrameSize;
+		}
+	}
+
+	bool CanCompile(const LispAst::NodeUniquePtr& lispAst)
+	{
+		auto program = CommonAst::AsNodePtr<const LispAst::ProgramNode*>(lispAst);
+		assert(program);
+		return FitsInFrame(MeasureFrame(*program));
+	}
+
+	Program::Program(Program&& other)
+	{
+		*this = std::move(other);
+	}
+
+	Program& Program::operator=(Program&& other)
+	{
+		std::swap(m_code, other.m_code);
+		std::swap(m_codeSize, other.m_codeSize);
+		std::swap(m_mappedSize, other.m_mappedSize);
+		std::swap(m_numResults, other.m_numResults);
+		return *this;
+	}
+
+#if JIT_SUPPORTED
+
+	namespace
+	{
+		// Native functions may throw, but there is no unwind info for generated code, so exceptions are caught in
+		// CallNative and the generated code returns early when it sees 'failed' set
+		struct Context
+		{
+			uint8_t failed = 0; // Must be first: generated code tests the byte at the context pointer
+			std::exception_ptr error;
+		};
+
+		using EntryPoint = void (*)(Value* results, Context* context);
+
+		Value CallNative(Context* context, const NativeRegistry::Entry* entry, const Value* args, size_t numArgs) noexcept
+		{
+			try
+			{
+				return entry->function(entry->userData, args, numArgs);
+			}
+			catch (...)
+			{
+				context->failed = 1;
+				context->error = std::current_exception();
+				return 0;
+			}
+		}
+
+		// Register use in generated code: rbx points at the value stack (slots of 8 bytes in the frame), r12 at the
+		// results and r13 at the Context. All three are callee-saved, so they survive calls to natives.
+		class Compiler
+		{
+		public:
+			explicit Compiler(const NativeRegistry& natives) : m_natives(natives) {}
+
+			void CompileProgram(const LispAst::ProgramNode& program)
+			{
+				EmitBytes({ 0x55 });						// push rbp
+				EmitBytes({ 0x48, 0x89, 0xE5 });			// mov rbp, rsp
+				EmitBytes({ 0x53 });						// push rbx
+				EmitBytes({ 0x41, 0x54 });					// push r12
+				EmitBytes({ 0x41, 0x55 });					// push r13
+				EmitBytes({ 0x41, 0x56 });					// push r14 (keeps rsp 16-byte aligned)
+				EmitBytes({ 0x48, 0x81, 0xEC });			// sub rsp, frameSize
+				const auto frameSizeOffset = m_code.size();
+				Emit32(0);
+				EmitBytes({ 0x48, 0x89, 0xE3 });			// mov rbx, rsp
+				EmitBytes({ 0x49, 0x89, 0xFC });			// mov r12, rdi
+				EmitBytes({ 0x49, 0x89, 0xF5 });			// mov r13, rsi
+
+				for (auto&& bodyNode : program.body)
+				{
+					CompileExpression(bodyNode.get(), 0);
+					EmitBytes({ 0x48, 0x8B, 0x83 });		// mov rax, [rbx + 0]
+					Emit32(0);
+					EmitBytes({ 0x49, 0x89, 0x84, 0x24 });	// mov [r12 + disp32], rax
+					Emit32(static_cast<uint32_t>(m_numResults++ * sizeof(Value)));
+				}
+
+				const auto epilogue = m_code.size();
+				EmitBytes({ 0x48, 0x8D, 0x65, 0xE0 });		// lea rsp, [rbp - 32]
+				EmitBytes({ 0x41, 0x5E });					// pop r14
+				EmitBytes({ 0x41, 0x5D });					// pop r13
+				EmitBytes({ 0x41, 0x5C });					// pop r12
+				EmitBytes({ 0x5B });						// pop rbx
+				EmitBytes({ 0x5D });						// pop rbp
+				EmitBytes({ 0xC3 });						// ret
+
+				const auto frameSize = (m_maxSlots * sizeof(Value) + 15) & ~size_t(15);
+				if (frameSize > 0x7fffffff)
+					throw std::runtime_error("Program too large to compile");
+				Patch32(frameSizeOffset, static_cast<uint32_t>(frameSize));
+				for (auto jumpOffset : m_errorJumps)
+					Patch32(jumpOffset, static_cast<uint32_t>(epilogue - (jumpOffset + 4)));
+			}
+
+			const std::vector<uint8_t>& GetCode() const { return m_code; }
+			size_t GetNumResults() const { return m_numResults; }
+
+		private:
+			// Generates code that stores the value of the expression in the given value stack slot. Slots above it are
+			// free to use as scratch space.
+			void CompileExpression(const CommonAst::Param& param, size_t slot)
+			{
+				if (param.IsLiteral())
+					StoreImmediate(param.GetLiteral(), slot);
+				else
+					CompileExpression(param.GetNode(), slot);
+			}
+
+			void CompileExpression(const LispAst::Node* node, size_t slot)
+			{
+				using namespace LispAst;
+
+				UseSlot(slot);
+				if (auto literal = AsNodePtr<const NumberLiteralNode*>(node))
+				{
+					StoreImmediate(literal->value, slot);
+				}
+				else if (auto call = AsNodePtr<const CallExpressionNode*>(node))
+				{
+					CompileCall(*call, slot);
+				}
+				else if (auto ref = AsNodePtr<const CallExpressionRefNode*>(node))
+				{
+					CompileCall(*ref->target, slot);
+				}
+				else
+				{
+					assert(false && "Unhandled node type");
+				}
+			}
+
+			void CompileCall(const LispAst::CallExpressionNode& call, size_t slot)
+			{
+				const auto id = m_natives.FindId(call.name);
+				if (id == NativeRegistry::InvalidId)
+					throw std::runtime_error("Unknown function '" + SymbolTable::GetName(call.name) + "'");
+
+				auto&& entry = m_natives.GetEntry(id);
+				if (entry.function == Interpreter::Builtins::Add)
+				{
+					CompileInlineArithmetic(call, slot, 0x03, 0x05);
+					StoreRax(slot);
+				}
+				else if (entry.function == Interpreter::Builtins::Subtract && !call.params.empty())
+				{
+					CompileInlineArithmetic(call, slot, 0x2B, 0x2D);
+					if (call.params.size() == 1)
+						EmitBytes({ 0x48, 0xF7, 0xD8 });	// neg rax
+					StoreRax(slot);
+				}
+				else
+				{
+					for (size_t i = 0; i < call.params.size(); ++i)
+						CompileExpression(call.params[i], slot + i);
+
+					EmitBytes({ 0x4C, 0x89, 0xEF });		// mov rdi, r13
+					EmitBytes({ 0x48, 0xBE });				// mov rsi, imm64
+					Emit64(reinterpret_cast<uint64_t>(&entry));
+					EmitBytes({ 0x48, 0x8D, 0x93 });		// lea rdx, [rbx + disp32]
+					Emit32(SlotOffset(slot));
+					EmitBytes({ 0xB9 });					// mov ecx, imm32
+					Emit32(static_cast<uint32_t>(call.params.size()));
+					EmitBytes({ 0x48, 0xB8 });				// mov rax, imm64
+					Emit64(reinterpret_cast<uint64_t>(&CallNative));
+					EmitBytes({ 0xFF, 0xD0 });				// call rax
+					EmitBytes({ 0x41, 0x80, 0x7D, 0x00, 0x00 }); // cmp byte [r13], 0
+					EmitBytes({ 0x0F, 0x85 });				// jne epilogue
+					m_errorJumps.push_back(m_code.size());
+					Emit32(0);
+					StoreRax(slot);
+				}
+			}
+
+			// Folds the arguments into rax with the given 'op rax, [rbx + disp32]' and 'op rax, imm32' opcodes, using
+			// slots from the given one up for the arguments that aren't literals. Literals are used as immediates.
+			void CompileInlineArithmetic(const LispAst::CallExpressionNode& call, size_t slot, uint8_t memoryOpCode, uint8_t immediateOpCode)
+			{
+				std::vector<size_t> argSlots(call.params.size());
+				size_t nextSlot = slot;
+				for (size_t i = 0; i < call.params.size(); ++i)
+				{
+					if (!call.params[i].IsLiteral())
+					{
+						argSlots[i] = nextSlot;
+						CompileExpression(call.params[i], nextSlot++);
+					}
+				}
+
+				for (size_t i = 0; i < call.params.size(); ++i)
+				{
+					auto&& param = call.params[i];
+					if (i == 0 && param.IsLiteral())
+					{
+						EmitBytes({ 0x48, 0xC7, 0xC0 });	// mov rax, imm32
+						Emit32(static_cast<uint32_t>(param.GetLiteral()));
+					}
+					else if (i == 0)
+					{
+						EmitBytes({ 0x48, 0x8B, 0x83 });	// mov rax, [rbx + disp32]
+						Emit32(SlotOffset(argSlots[i]));
+					}
+					else if (param.IsLiteral())
+					{
+						EmitBytes({ 0x48, immediateOpCode });
+						Emit32(static_cast<uint32_t>(param.GetLiteral()));
+					}
+					else
+					{
+						EmitBytes({ 0x48, memoryOpCode, 0x83 });
+						Emit32(SlotOffset(argSlots[i]));
+					}
+				}
+
+				if (call.params.empty())
+					EmitBytes({ 0x31, 0xC0 });				// xor eax, eax
+			}
+
+			void StoreImmediate(int value, size_t slot)
+			{
+				UseSlot(slot);
+				EmitBytes({ 0x48, 0xC7, 0x83 });			// mov qword [rbx + disp32], imm32
+				Emit32(SlotOffset(slot));
+				Emit32(static_cast<uint32_t>(value));
+			}
+
+			void StoreRax(size_t slot)
+			{
+				UseSlot(slot);
+				EmitBytes({ 0x48, 0x89, 0x83 });			// mov [rbx + disp32], rax
+				Emit32(SlotOffset(slot));
+			}
+
+			void UseSlot(size_t slot)
+			{
+				m_maxSlots = std::max(m_maxSlots, slot + 1);
+			}
+
+			static uint32_t SlotOffset(size_t slot)
+			{
+				return static_cast<uint32_t>(slot * sizeof(Value));
+			}
+
+			void EmitBytes(std::initializer_list<uint8_t> bytes)
+			{
+				m_code.insert(m_code.end(), bytes);
+			}
+
+			void Emit32(uint32_t value)
+			{
+				for (int i = 0; i < 4; ++i)
+					m_code.push_back(static_cast<uint8_t>(value >> (i * 8)));
+			}
+
+			void Emit64(uint64_t value)
+			{
+				for (int i = 0; i < 8; ++i)
+					m_code.push_back(static_cast<uint8_t>(value >> (i * 8)));
+			}
+
+			void Patch32(size_t offset, uint32_t value)
+			{
+				for (int i = 0; i < 4; ++i)
+					m_code[offset + i] = static_cast<uint8_t>(value >> (i * 8));
+			}
+
+			const NativeRegistry& m_natives;
+			std::vector<uint8_t> m_code;
+			std::vector<size_t> m_errorJumps; // Offsets of rel32 operands to patch with the epilogue
+			size_t m_maxSlots = 0;
+			size_t m_numResults = 0;
+		};
+	}
+
+	Program::~Program()
+	{
+		if (m_code)
+			munmap(m_code, m_mappedSize);
+	}
+
+	Program Compile(const LispAst::NodeUniquePtr& lispAst, const NativeRegistry& natives)
+	{
+		auto programNode = CommonAst::AsNodePtr<const LispAst::ProgramNode*>(lispAst);
+		assert(programNode);
+
+		if (!FitsInFrame(MeasureFrame(*programNode)))
+			throw std::runtime_error("Calls are nested too deeply or have too many arguments to compile");
+
+		Compiler compiler(natives);
+		compiler.CompileProgram(*programNode);
+		auto&& code = compiler.GetCode();
+
+		// Written while writable, then flipped to executable, so the mapping is never both
+		const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		const size_t mappedSize = (code.size() + pageSize - 1) / pageSize * pageSize;
+		void* memory = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+			throw std::runtime_error("Cannot allocate memory for generated code");
+		std::memcpy(memory, code.data(), code.size());
+		if (mprotect(memory, mappedSize, PROT_READ | PROT_EXEC) != 0)
+		{
+			munmap(memory, mappedSize);
+			throw std::runtime_error("Cannot make generated code executable");
+		}
+
+		Program program;
+		program.m_code = memory;
+		program.m_codeSize = code.size();
+		program.m_mappedSize = mappedSize;
+		program.m_numResults = compiler.GetNumResults();
+		return program;
+	}
+
+	std::vector<Value> Execute(const Program& program)
+	{
+		if (!program.m_code)
+			throw std::logic_error("Executing a program that wasn't compiled");
+
+		std::vector<Value> results(program.m_numResults);
+		Context context;
+		reinterpret_cast<EntryPoint>(program.m_code)(results.data(), &context);
+		if (context.failed)
+			std::rethrow_exception(context.error);
+		return results;
+	}
+
+#else
+
+	Program::~Program()
+	{
+	}
+
+	Program Compile(const LispAst::NodeUniquePtr&, const NativeRegistry&)
+	{
+		throw std::logic_error("The JIT is only supported on x86-64 Linux");
+	}
+
+	std::vector<Value> Execute(const Program&)
+	{
+		throw std::logic_error("The JIT is only supported on x86-64 Linux");
+	}
+
+#endif
+}
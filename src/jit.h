@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "interpreter.h"
+
+// Compiles Lisp programs to x86-64 machine code in an executable buffer. Calls to the default add and subtract are
+// inlined; other calls go to their native functions.
+namespace Jit
+{
+	// True on x86-64 Linux. Elsewhere, Compile throws std::logic_error and callers should use the interpreter instead.
+	bool IsSupported();
+
+	// Generated code keeps the values of pending arguments in its native stack frame: a slot per nesting level, and per
+	// argument of calls to natives. The frame is allocated at once without probing the stack, so Compile rejects
+	// programs with calls nested deeper than MaxNestingDepth, or needing a frame larger than MaxFrameSize bytes.
+	const size_t MaxNestingDepth = 4096;
+	const size_t MaxFrameSize = 64 * 1024;
+
+	// False if Compile would reject the program for its nesting or frame size; callers should use the interpreter instead
+	bool CanCompile(const LispAst::NodeUniquePtr& lispAst);
+
+	// Owns the executable memory of a compiled program; movable, not copyable
+	class Program
+	{
+	public:
+		Program() = default;
+		Program(Program&& other);
+		Program& operator=(Program&& other);
+		~Program();
+
+		size_t CodeSize() const { return m_codeSize; }
+
+	private:
+		friend Program Compile(const LispAst::NodeUniquePtr& lispAst, const Interpreter::NativeRegistry& natives);
+		friend std::vector<Interpreter::Value> Execute(const Program& program);
+
+		void* m_code = nullptr;
+		size_t m_codeSize = 0;
+		size_t m_mappedSize = 0;
+		size_t m_numResults = 0;
+	};
+
+	// Throws std::runtime_error on calls to functions that aren't registered in natives, or if CanCompile is false. The program refers to the
+	// registry's entries, so natives must outlive it and not be modified.
+	Program Compile(const LispAst::NodeUniquePtr& lispAst, const Interpreter::NativeRegistry& natives);
+
+	// Returns the value of each top-level form. Exceptions thrown by native functions are rethrown here.
+	std::vector<Interpreter::Value> Execute(const Program& program);
+}
@@ -1,572 +1,429 @@
 #include <string>
 #include <vector>
-#include <memory>
 #include <iostream>
+#include <fstream>
 #include <sstream>
-#include <map>
 #include <stdexcept>
-#include "variant_match.h"
-
-struct Token
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include "pipeline.h"
+#include "server.h"
+#include "watch.h"
+#include "stats.h"
+#include "trace.h"
+
+void Compile(const std::string& lispCode, std::ostream& os)
 {
-	enum class Type { Paren, Name, Number };
-	Type type;
-	std::string value;
-};
+	const bool printAsts = true;
 
-std::vector<Token> Tokenize(const std::string text)
-{
-	std::vector<Token> tokens;
+	os << "Input Lisp code:\n" << lispCode << "\n";
 
-	struct Looking {};
-	struct InString { std::string value; };
-	struct InNumber { std::string value; };
+	/////////////////////
+	// Parsing
+	/////////////////////
 
-	auto state = std::experimental::variant<Looking, InString, InNumber>{ Looking{} };
+	// 1. lexical analysis (tokenizing)
+	auto tokens = Tokenize(lispCode);
 
-	size_t i = 0;
-	while (i < text.size())
-	{
-		const char c = text[i];
-		const auto cs = std::string(1, c);
+	// 2. syntactic analysis (create the Lisp AST)
+	auto lispAst = LispAst::Parse(tokens);
 
-		match(state,
-			[&](Looking& looking)
-			{
-				if (c == ' ' || c == '\t' || c == '\n') // Whitespace
-				{
-					++i;
-				}
-				else if (c == '(' || c == ')')
-				{
-					tokens.emplace_back(Token{ Token::Type::Paren, cs });
-					++i;
-				}
-				else if (isalpha(c))
-				{
-					state = InString{};
-				}
-				else if (isdigit(c))
-				{
-					state = InNumber{};
-				}
-				else
-				{
-					throw std::logic_error("Unexpected character");
-				}
-			},
-			[&](InString& inString)
-			{
-				if (isalpha(c))
-				{
-					inString.value += cs;
-					++i;
-				}
-				else
-				{
-					tokens.emplace_back(Token{ Token::Type::Name, inString.value });
-					state = Looking{};
-				}
-			},
-			[&](InNumber& inNumber)
-			{
-				if (isdigit(c))
-				{
-					inNumber.value += cs;
-					++i;
-				}
-				else
-				{
-					tokens.emplace_back(Token{ Token::Type::Number, inNumber.value });
-					state = Looking{};
-				}
-			}
-		);
+	if (printAsts)
+	{
+		os << "Lisp AST:\n";
+		LispAst::PrintAst(lispAst, os);
+		os << '\n';
 	}
 
-	return tokens;
-}
-
-namespace CommonAst
-{
-	struct Node
-	{
-		virtual ~Node() = default;
-	};
+	/////////////////////
+	// Transformation
+	/////////////////////
 
-	using NodeUniquePtr = std::unique_ptr<Node>;
+	auto cppAst = TransformLispAstToCppAst(lispAst);
 
-	template <typename TargetNodeType, typename NodeType>
-	auto AsNodePtr(NodeType&& node)
+	if (printAsts)
 	{
-		return dynamic_cast<TargetNodeType>(node.get());
+		os << "Cpp AST:\n";
+		CppAst::PrintAst(cppAst, os);
+		os << '\n';
 	}
+
+	/////////////////////
+	// Code Generation
+	/////////////////////
+
+	auto cppCode = GenerateCppCode(cppAst);
+	os << "Generated Cpp Code:\n" << cppCode << '\n';
 }
 
-namespace LispAst
+namespace
 {
-	using namespace CommonAst;
-
-	struct ProgramNode : Node
+	void PrintUsage(std::ostream& os)
 	{
-		std::string name;
-		std::vector<NodeUniquePtr> body;
-	};
+		os << "Usage:\n"
+			"  TinyCompiler                          Compile a built-in example, printing ASTs\n"
+			"  TinyCompiler <file.lisp|->...         Compile files ('-' for stdin) and print the C++ code\n"
+			"      --eval | --eval=bytecode|jit      Evaluate the program and print the value of each form instead,\n"
+			"                                        with the tree-walking interpreter, the bytecode VM or the JIT\n"
+			"      --stats | --stats=json            Report per-phase time and allocations, and process peak RSS, on stderr\n"
+			"      --hash-cons                       Share identical nested calls while parsing\n"
+			"      --ast-cache <dir>                 Cache parsed ASTs as images in dir, skipping Tokenize and Parse\n"
+			"                                        for sources that haven't changed\n"
+			"      --fold | --fold=<f1,f2,...>       Evaluate calls to pure builtins (add, subtract, multiply) on literals\n"
+			"      --cse=<f1,f2,...>                 Hoist repeated calls to the given pure functions into temporaries\n"
+			"      --constexpr                       Emit constexpr builtins and compute constant calls in constexpr variables\n"
+			"      --perf-counters                   Add hardware counters (IPC, misses per token) to --stats\n"
+			"      --trace <out.json>                Record a Chrome trace-event / Perfetto timeline\n"
+			"      -j, --jobs <n>                    Compile files on n worker threads\n"
+			"  TinyCompiler --watch <dir>            Compile .lisp files under dir to .cpp, recompiling on change\n"
+			"  TinyCompiler --server <socket>        Run a compile server on a Unix domain socket\n"
+			"  TinyCompiler --client <socket> <args> Forward args to a compile server\n"
+			"  TinyCompiler --client <socket> --server-stats | --server-stop\n";
+	}
 
-	struct CallExpressionNode : Node
+	std::string ReadStream(std::istream& is)
 	{
-		std::string name;
-		std::vector<NodeUniquePtr> params;
-	};
+		std::stringstream sstream;
+		sstream << is.rdbuf();
+		return sstream.str();
+	}
 
-	struct NumberLiteralNode : Node
+	void RunExample(std::ostream& os)
 	{
-		int value;
-		NumberLiteralNode(int v) : value(v) {}
-	};
+	/*
+	 *                  LISP                      C
+	 *
+	 *   2 + 2          (add 2 2)                 add(2, 2)
+	 *   4 - 2          (subtract 4 2)            subtract(4, 2)
+	 *   2 + (4 - 2)    (add 2 (subtract 4 2))    add(2, subtract(4, 2))
+	 */
+		std::string lispCode =
+			"(add 2 (subtract 4 2))\n"
+			"(subtract 3 7)\n"
+			"(foo (bar (len 2 3)))\n"
+			;
+
+		Compile(lispCode, os);
+	}
+}
 
-	namespace
+// Runs one command line (excluding the program name). Shared by the normal entry point and the compile server.
+int RunCommand(const std::vector<std::string>& args, std::istream& in, std::ostream& out, std::ostream& err)
+{
+	enum class StatsFormat { None, Text, Json };
+	auto statsFormat = StatsFormat::None;
+	CompileOptions compileOptions;
+	bool collectHardwareCounters = false;
+	std::string tracePath;
+	int numWorkers = 1;
+	std::vector<std::string> inputs;
+
+	for (size_t i = 0; i < args.size(); ++i)
 	{
-		NodeUniquePtr ParseCallExpression(std::vector<Token>::const_iterator& iter, const std::vector<Token>::const_iterator& endIter)
+		const auto& arg = args[i];
+		auto NextValue = [&]() -> const std::string*
 		{
-			auto callExpression = std::make_unique<CallExpressionNode>();
-
-			const auto& firstToken = *iter;
-			if (firstToken.type != Token::Type::Name)
-				throw std::logic_error("Expecting function name immediately after '('");
-
-			callExpression->name = iter->value;
-			++iter;
-
-			while (iter != endIter)
-			{
-				switch (iter->type)
-				{
-				case Token::Type::Paren:
-					if (iter->value == ")")
-					{
-						++iter;
-						return std::move(callExpression);
-					}
-					else
-					{
-						++iter;
-						callExpression->params.emplace_back(ParseCallExpression(iter, endIter));
-					}
-					break;
-
-				case Token::Type::Name:
-					throw std::logic_error("Unexpected name token in argument list");
-					break;
-
-				case Token::Type::Number:
-					callExpression->params.emplace_back(std::make_unique<NumberLiteralNode>(stoi(iter->value)));
-					++iter;
-					break;
-				}
-			}
-
-			throw std::logic_error("Missing ')' to end call expression");
+			if (i + 1 < args.size())
+				return &args[++i];
+			err << "Missing value for option " << arg << '\n';
 			return nullptr;
-		}
-	}
-
-	NodeUniquePtr Parse(const std::vector<Token>& tokens)
-	{
-		using namespace LispAst;
-		auto programNode = std::make_unique<ProgramNode>();
-
-		auto tokenIter = begin(tokens);
-		auto tokenEnd = end(tokens);
+		};
 
-		// Loop here for each top-level call expression
-		// e.g.
-		//		(add 1 2)
-		//		(sub 3 4)
-		while (tokenIter != tokenEnd)
+		if (arg == "--help" || arg == "-h")
 		{
-			const auto& firstToken = *tokenIter;
-			if (!(firstToken.type == Token::Type::Paren && firstToken.value == "("))
-				throw std::logic_error("Program must start with '('");
-			++tokenIter;
-
-			programNode->body.emplace_back(ParseCallExpression(tokenIter, tokenEnd));
+			PrintUsage(out);
+			return 0;
 		}
-
-		return std::move(programNode);
-	}
-
-	struct Visitor
-	{
-		virtual void OnVisit(const ProgramNode& program, int depth) {}
-		virtual void OnVisit(const CallExpressionNode& callExpression, const Node& parent, int depth) {}
-		virtual void OnVisit(const NumberLiteralNode& numberLiteral, const Node& parent, int depth) {}
-	};
-
-	void Visit(const NodeUniquePtr& rootNode, const Node* parent, Visitor& visitor, int depth = 0)
-	{
-		if (auto node = AsNodePtr<const ProgramNode*>(rootNode))
+		else if (arg == "--eval" || arg == "--eval=tree")
 		{
-			assert(parent == nullptr);
-			visitor.OnVisit(*node, depth);
-			for (auto&& n : node->body)
-				Visit(n, node, visitor, depth + 1);
+			compileOptions.backend = Backend::Interpreter;
 		}
-		else if (auto node = AsNodePtr<const CallExpressionNode*>(rootNode))
+		else if (arg == "--eval=bytecode")
 		{
-			visitor.OnVisit(*node, *parent, depth);
-			for (auto&& n : node->params)
-				Visit(n, node, visitor, depth + 1);
+			compileOptions.backend = Backend::Bytecode;
 		}
-		else if (auto node = AsNodePtr<const NumberLiteralNode*>(rootNode))
+		else if (arg == "--eval=jit")
 		{
-			visitor.OnVisit(*node, *parent, depth);
+			compileOptions.backend = Backend::Jit;
 		}
-		else
+		else if (arg == "--stats")
 		{
-			assert(false && "Unhandled node type");
+			statsFormat = StatsFormat::Text;
 		}
-	}
-
-	void PrintAst(const NodeUniquePtr& lispAst, std::ostream& os)
-	{
-		struct PrintAST : Visitor
+		else if (arg == "--stats=json")
 		{
-			std::ostream& os;
-			PrintAST(std::ostream& os) : os(os) {}
-
-			void Indent(int depth)
+			statsFormat = StatsFormat::Json;
+		}
+		else if (arg == "--perf-counters")
+		{
+			collectHardwareCounters = true;
+		}
+		else if (arg == "--hash-cons")
+		{
+			compileOptions.parse.hashCons = true;
+		}
+		else if (arg == "--fold")
+		{
+			compileOptions.foldConstants = true;
+		}
+		else if (arg.compare(0, 7, "--fold=") == 0)
+		{
+			compileOptions.foldConstants = true;
+			compileOptions.fold = ConstantFolding::Options();
+			std::stringstream names(arg.substr(7));
+			std::string name;
+			while (std::getline(names, name, ','))
 			{
-				for (int i = 0; i < depth; ++i)
+				auto function = ConstantFolding::FindKnownBuiltin(name);
+				if (!function)
 				{
-					os << "  ";
+					err << "Unknown builtin for --fold: " << name << '\n';
+					return 1;
 				}
+				compileOptions.fold.Add(name, function);
 			}
-
-			virtual void OnVisit(const ProgramNode& program, int depth)
-			{
-				os << "[Program]\n";
-			}
-			virtual void OnVisit(const CallExpressionNode& callExpression, const Node& parent, int depth)
-			{
-				Indent(depth);
-				os << "[CallExpression] name: " << callExpression.name << '\n';
-			}
-			virtual void OnVisit(const NumberLiteralNode& numberLiteral, const Node& parent, int depth)
-			{
-				Indent(depth);
-				os << "[NumberLiteral] value: " << numberLiteral.value << '\n';
-			}
-		};
-
-		auto printAST = PrintAST(os);
-		LispAst::Visit(lispAst, nullptr, printAST);
-	}
-} // namespace LispAst
-
-namespace CppAst
-{
-	using namespace CommonAst;
-
-	struct ProgramNode : Node
-	{
-		std::string name;
-		std::vector<NodeUniquePtr> body;
-	};
-
-	struct IdentifierNode : Node
-	{
-		std::string name;
-		IdentifierNode(std::string name) : name(std::move(name)) {}
-	};
-
-	struct NumberLiteralNode : Node
-	{
-		int value;
-		NumberLiteralNode(int v) : value(v) {}
-	};
-
-	struct CallExpressionNode : Node
-	{
-		//NodeUniquePtr callee;
-		std::unique_ptr<IdentifierNode> callee;
-		std::vector<NodeUniquePtr> params;
-	};
-
-	struct ExpressionStatementNode : Node
-	{
-		//NodeUniquePtr expression;
-		std::unique_ptr<CallExpressionNode> expression;
-	};
-
-	template <typename NodeUniquePtrType> // Note: need template only because 'callee' and 'expression' are not NodeUniquePtrs
-	void PrintAst(const NodeUniquePtrType& rootNode, std::ostream& os, int depth=0)
-	{
-		auto Indent = [&os](int depth)
+		}
+		else if (arg.compare(0, 6, "--cse=") == 0)
 		{
-			for (int i = 0; i < depth; ++i)
+			compileOptions.eliminateCommonSubexpressions = true;
+			std::stringstream names(arg.substr(6));
+			std::string name;
+			while (std::getline(names, name, ','))
 			{
-				os << "  ";
+				if (!name.empty())
+					compileOptions.cse.AddPureFunction(name);
 			}
-		};
-
-		if (auto node = AsNodePtr<const ProgramNode*>(rootNode))
+		}
+		else if (arg == "--constexpr")
 		{
-			Indent(depth); os << "[Program]\n";
-			Indent(depth); os << " Body:\n";
-			for (auto&& bodyNode : node->body)
-			{
-				PrintAst(bodyNode, os, depth + 1);
-			}
+			compileOptions.codeGen.constexprBuiltins = true;
 		}
-		else if (auto node = AsNodePtr<const ExpressionStatementNode*>(rootNode))
+		else if (arg == "--ast-cache")
 		{
-			Indent(depth); os << "[ExpressionStatement]\n";
-			Indent(depth); os << " Expression:\n";
-			PrintAst(node->expression, os, depth + 1);
+			auto value = NextValue();
+			if (!value)
+				return 1;
+			compileOptions.astCacheDirectory = *value;
 		}
-		else if (auto node = AsNodePtr<const CallExpressionNode*>(rootNode))
+		else if (arg == "--trace")
 		{
-			Indent(depth); os << "[CallExpression]\n";
-			Indent(depth); os << " Callee:\n";
-			PrintAst(node->callee, os, depth + 1);
-			Indent(depth); os << " Params:\n";
-			for (auto&& param : node->params)
-			{
-				PrintAst(param, os, depth + 1);
-			}
-
+			auto value = NextValue();
+			if (!value)
+				return 1;
+			tracePath = *value;
 		}
-		else if (auto node = AsNodePtr<const IdentifierNode*>(rootNode))
+		else if (arg == "-j" || arg == "--jobs")
 		{
-			Indent(depth); os << "[Identifier] name: " << node->name << '\n';
+			auto value = NextValue();
+			if (!value)
+				return 1;
+			numWorkers = std::atoi(value->c_str());
+			if (numWorkers < 1)
+			{
+				err << "Invalid number of jobs: " << *value << '\n';
+				return 1;
+			}
 		}
-		else if (auto node = AsNodePtr<const NumberLiteralNode*>(rootNode))
+		else if (arg.size() > 1 && arg[0] == '-')
 		{
-			Indent(depth); os << "[NumberLiteralNode] value: " << node->value << '\n';
+			err << "Unknown option: " << arg << '\n';
+			PrintUsage(err);
+			return 1;
 		}
 		else
 		{
-			assert(false && "Unhandled node type");
+			inputs.push_back(arg);
 		}
 	}
-} // namespace CppAst
-
-// std::less<reference_wrapper<T>> doesn't work in containers like map, so use this instead
-template <typename T>
-struct reference_wrapper_less
-{
-	bool operator()(const std::reference_wrapper<T>& lhs, const std::reference_wrapper<T>& rhs) const { return &lhs.get() < &rhs.get(); }
-};
 
-CppAst::NodeUniquePtr TransformLispAstToCppAst(const LispAst::NodeUniquePtr& lispAst)
-{
-	struct Transformer : LispAst::Visitor
+	if (inputs.empty())
 	{
-		CppAst::NodeUniquePtr m_programNode;
+		RunExample(out);
+		return 0;
+	}
 
-		// Map of Lisp parent nodes to Cpp vectors of nodes. This basically allows us to find the relevant parent
-		// vector to add a Cpp node to from within visitor callbacks.
-		std::map<
-			std::reference_wrapper<const LispAst::Node>,
-			std::reference_wrapper<std::vector<CppAst::NodeUniquePtr>>,
-			reference_wrapper_less<const LispAst::Node>
-		> m_context;
+	if (collectHardwareCounters && statsFormat == StatsFormat::None)
+		statsFormat = StatsFormat::Text;
 
-		void AddNodeToVectorMapping(const LispAst::Node& node, std::vector<CppAst::NodeUniquePtr>& vec)
-		{
-			m_context.emplace(std::cref(node), std::ref(vec));
-		}
+	struct CompileJob
+	{
+		std::string path;
+		std::string lispCode;
+		std::string output;
+		std::string error;
+		Stats::CompileStats stats;
+	};
 
-		std::vector<CppAst::NodeUniquePtr>& GetContextVector(const LispAst::Node& lispNode)
+	std::vector<CompileJob> jobs(inputs.size());
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		auto& job = jobs[i];
+		job.path = inputs[i];
+		job.stats.inputName = job.path;
+		job.stats.collectHardwareCounters = collectHardwareCounters;
+		if (job.path == "-")
 		{
-			auto iter = m_context.find(lispNode);
-			assert(iter != m_context.end());
-			return iter->second.get();
+			job.lispCode = ReadStream(in);
 		}
-
-		virtual void OnVisit(const LispAst::ProgramNode& lispProgramNode, int depth)
+		else
 		{
-			assert(m_programNode == nullptr);
-			auto cppProgramNode = std::make_unique<CppAst::ProgramNode>();
-			AddNodeToVectorMapping(lispProgramNode, cppProgramNode->body);
-			m_programNode = std::move(cppProgramNode);
+			std::ifstream file(job.path, std::ios::binary);
+			if (!file)
+			{
+				err << job.path << ": error: cannot open file\n";
+				return 1;
+			}
+			job.lispCode = ReadStream(file);
 		}
+	}
 
-		virtual void OnVisit(const LispAst::CallExpressionNode& lispCallExpressionNode, const LispAst::Node& parent, int depth)
-		{
-			assert(m_programNode);
-
-			// Create call expression with nested identifier and no parameters
-			auto callExpressionNode = std::make_unique<CppAst::CallExpressionNode>();
-			callExpressionNode->callee = std::make_unique<CppAst::IdentifierNode>(lispCallExpressionNode.name);
+	if (!tracePath.empty())
+	{
+		Trace::Start();
+		Trace::SetThreadName("main");
+	}
 
-			// Add mapping from the Lisp CallExpressionNode to the parameter vector of our new Cpp CallExpressionNode
-			AddNodeToVectorMapping(lispCallExpressionNode, callExpressionNode->params);
-			
-			auto newNode = [&]() -> CppAst::NodeUniquePtr
-			{
-				// If parent is not a CallExpression, we wrap up our Cpp CallExpression node with an ExpressionStatement,
-				// because in C++, top-level call expressions are statements.
-				if (!dynamic_cast<const LispAst::CallExpressionNode*>(&parent))
-				{
-					auto expressionStatementNode = std::make_unique<CppAst::ExpressionStatementNode>();
-					expressionStatementNode->expression = std::move(callExpressionNode);
-					//callExpressionNode = std::move(expressionStatementNode);
-					return std::move(expressionStatementNode);
-				}
-				else
-				{
-					return std::move(callExpressionNode);
-				}
-			} ();
+	auto CompileOne = [statsFormat, &compileOptions](CompileJob& job, std::ostream& jobOut)
+	{
+		// One per worker thread, so that each file reuses the buffers left by the previous one
+		thread_local CompilerContext context;
 
-			// Add new node to parent's context
-			GetContextVector(parent).push_back(std::move(newNode));
+		Trace::Scope scope("file", job.path);
+		try
+		{
+			if (statsFormat == StatsFormat::None)
+				jobOut << context.RunPipeline(job.lispCode, compileOptions);
+			else
+				Stats::CompileWithStats(context, job.lispCode, compileOptions, jobOut, job.stats);
+			return true;
 		}
-
-		virtual void OnVisit(const LispAst::NumberLiteralNode& lispNumberLiteralNode, const LispAst::Node& parent, int depth)
+		catch (const std::exception& e)
 		{
-			assert(m_programNode);
-			auto newNode = std::make_unique<CppAst::NumberLiteralNode>(lispNumberLiteralNode.value);
-			GetContextVector(parent).push_back(std::move(newNode));
+			job.error = e.what();
+			return false;
 		}
 	};
 
-	auto transformer = Transformer();
-	LispAst::Visit(lispAst, nullptr, transformer);
+	auto ReportStats = [&](const CompileJob& job)
+	{
+		if (statsFormat == StatsFormat::Text)
+			Stats::PrintText(job.stats, err);
+	};
 
-	return std::move(transformer.m_programNode);
-}
+	int exitCode = 0;
 
-namespace impl
-{
-	template <typename NodeUniquePtrType>
-	void GenerateCppCodeImpl(const NodeUniquePtrType& rootNode, std::ostream& os, int depth = 0)
+	if (numWorkers == 1 || jobs.size() == 1)
 	{
-		using namespace CppAst;
-		
-		auto Indent = [&](int depth)
+		for (auto&& job : jobs)
 		{
-			for (int i = 0; i < depth; ++i)
+			if (!CompileOne(job, out))
 			{
-				os << "  ";
+				err << job.path << ": error: " << job.error << '\n';
+				exitCode = 1;
+				break;
 			}
-		};
-
-		if (auto node = AsNodePtr<const ProgramNode*>(rootNode))
+			ReportStats(job);
+		}
+	}
+	else
+	{
+		// Workers pull files from a shared index and buffer their output, which is then written in input order
+		std::atomic<size_t> nextJob(0);
+		auto Worker = [&](int workerIndex)
 		{
-			os << "int main()\n";
-			os << "{\n";
-			for (auto&& bodyNode : node->body)
+			Trace::SetThreadName("worker " + std::to_string(workerIndex));
+			for (;;)
 			{
-				GenerateCppCodeImpl(bodyNode, os, depth + 1);
+				const size_t index = nextJob++;
+				if (index >= jobs.size())
+					break;
+				Trace::Counter("pending files", static_cast<int64_t>(jobs.size() - index - 1));
+
+				std::ostringstream jobOut;
+				CompileOne(jobs[index], jobOut);
+				jobs[index].output = jobOut.str();
 			}
-			os << "}\n";
-		}
-		else if (auto node = AsNodePtr<const ExpressionStatementNode*>(rootNode))
-		{
-			Indent(depth);
-			GenerateCppCodeImpl(node->expression, os, depth + 1);
-			os << ";\n";
-		}
-		else if (auto node = AsNodePtr<const CallExpressionNode*>(rootNode))
+		};
+
+		std::vector<std::thread> workers;
+		for (int i = 0; i < std::min<int>(numWorkers, static_cast<int>(jobs.size())); ++i)
+			workers.emplace_back(Worker, i + 1);
+		for (auto&& worker : workers)
+			worker.join();
+
+		for (auto&& job : jobs)
 		{
-			GenerateCppCodeImpl(node->callee, os, depth + 1);
-			os << "(";
-			for (auto iter = begin(node->params); iter != end(node->params); ++iter)
+			if (!job.error.empty())
 			{
-				auto&& param = *iter;
-				GenerateCppCodeImpl(param, os, depth + 1);
-				if ((iter + 1) != end(node->params))
-				{
-					os << ", ";
-				}
+				err << job.path << ": error: " << job.error << '\n';
+				exitCode = 1;
+				break;
 			}
-			os << ")";
-		}
-		else if (auto node = AsNodePtr<const IdentifierNode*>(rootNode))
-		{
-			os << node->name;
-		}
-		else if (auto node = AsNodePtr<const NumberLiteralNode*>(rootNode))
-		{
-			os << node->value;
-		}
-		else
-		{
-			assert(false && "Unhandled node type");
+			out << job.output;
+			ReportStats(job);
 		}
 	}
-} // namespace impl
-
-std::string GenerateCppCode(const CppAst::NodeUniquePtr& cppAst)
-{
-	std::stringstream sstream;
-	impl::GenerateCppCodeImpl(cppAst, sstream);
-	return sstream.str();
-}
-
-void Compile(const std::string& lispCode)
-{
-	const bool printAsts = true;
-
-	std::cout << "Input Lisp code:\n" << lispCode << "\n";
 
-	/////////////////////
-	// Parsing
-	/////////////////////
-
-	// 1. lexical analysis (tokenizing)
-	auto tokens = Tokenize(lispCode);
-
-	// 2. syntactic analysis (create the Lisp AST)
-	auto lispAst = LispAst::Parse(tokens);
+	if (exitCode == 0 && statsFormat == StatsFormat::Json)
+	{
+		std::vector<Stats::CompileStats> allStats;
+		for (auto&& job : jobs)
+			allStats.push_back(job.stats);
+		Stats::PrintJson(allStats, err);
+	}
 
-	if (printAsts)
+	if (!tracePath.empty() && !Trace::StopAndWrite(tracePath))
 	{
-		std::cout << "Lisp AST:\n";
-		LispAst::PrintAst(lispAst, std::cout);
-		std::cout << '\n';
+		err << tracePath << ": error: cannot write trace\n";
+		exitCode = 1;
 	}
 
-	/////////////////////
-	// Transformation
-	/////////////////////
+	return exitCode;
+}
 
-	auto cppAst = TransformLispAstToCppAst(lispAst);
+int main(int argc, char* argv[])
+{
+	std::vector<std::string> args(argv + 1, argv + argc);
 
-	if (printAsts)
+	if (!args.empty() && args[0] == "--watch")
 	{
-		std::cout << "Cpp AST:\n";
-		CppAst::PrintAst(cppAst, std::cout);
-		std::cout << '\n';
+		if (args.size() != 2)
+		{
+			PrintUsage(std::cerr);
+			return 1;
+		}
+		return Watch::Run(args[1]);
 	}
 
-	/////////////////////
-	// Code Generation
-	/////////////////////
+	if (!args.empty() && args[0] == "--server")
+	{
+		if (args.size() != 2)
+		{
+			PrintUsage(std::cerr);
+			return 1;
+		}
+		// Interning the builtins for the default options first keeps them below the checkpoint, so the symbols of past
+		// requests can be trimmed before each new one
+		const CompileOptions defaultOptions;
+		const SymbolTable::Checkpoint symbols;
+		return Server::Run(args[1], [&symbols](const std::vector<std::string>& args, std::istream& in, std::ostream& out, std::ostream& err)
+		{
+			symbols.Trim();
+			return RunCommand(args, in, out, err);
+		});
+	}
 
-	auto cppCode = GenerateCppCode(cppAst);
-	std::cout << "Generated Cpp Code:\n" << cppCode << '\n';
-}
+	if (!args.empty() && args[0] == "--client")
+	{
+		if (args.size() < 2)
+		{
+			PrintUsage(std::cerr);
+			return 1;
+		}
+		return Server::RunClient(args[1], std::vector<std::string>(args.begin() + 2, args.end()));
+	}
 
-int main(int argc, char* argv[])
-{
-/*
- *                  LISP                      C
- *
- *   2 + 2          (add 2 2)                 add(2, 2)
- *   4 - 2          (subtract 4 2)            subtract(4, 2)
- *   2 + (4 - 2)    (add 2 (subtract 4 2))    add(2, subtract(4, 2))
- */
-	std::string lispCode =
-		"(add 2 (subtract 4 2))\n"
-		"(subtract 3 7)\n"
-		"(foo (bar (len 2 3)))\n"
-		;
-
-	Compile(lispCode);
-
-	return 0;
+	return RunCommand(args, std::cin, std::cout, std::cerr);
 }
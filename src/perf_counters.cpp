@@ -0,0 +1,125 @@
+#include "perf_counters.h"
+
+#if defined(__linux__)
+#include <cstring>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+namespace PerfCounters
+{
+	const char* GetCounterName(Counter counter)
+	{
+		switch (counter)
+		{
+		case Cycles: return "cycles";
+		case Instructions: return "instructions";
+		case BranchMisses: return "branchMisses";
+		case L1DCacheMisses: return "l1dMisses";
+		case LLCMisses: return "llcMisses";
+		case DTLBMisses: return "dtlbMisses";
+		default: return "unknown";
+		}
+	}
+
+	Sample operator-(const Sample& end, const Sample& start)
+	{
+		Sample result;
+		for (int i = 0; i < NumCounters; ++i)
+		{
+			result.available[i] = end.available[i] && start.available[i];
+			result.values[i] = result.available[i] ? end.values[i] - start.values[i] : 0;
+		}
+		return result;
+	}
+
+#if defined(__linux__)
+
+	namespace
+	{
+		uint64_t HardwareCacheConfig(uint64_t cache)
+		{
+			return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		}
+
+		int OpenCounter(uint32_t type, uint64_t config)
+		{
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = type;
+			attr.config = config;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+			// Calling thread only, on any CPU
+			return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+		}
+	}
+
+	CounterGroup::CounterGroup()
+	{
+		m_fds[Cycles] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+		m_fds[Instructions] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+		m_fds[BranchMisses] = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+		m_fds[L1DCacheMisses] = OpenCounter(PERF_TYPE_HW_CACHE, HardwareCacheConfig(PERF_COUNT_HW_CACHE_L1D));
+		m_fds[LLCMisses] = OpenCounter(PERF_TYPE_HW_CACHE, HardwareCacheConfig(PERF_COUNT_HW_CACHE_LL));
+		m_fds[DTLBMisses] = OpenCounter(PERF_TYPE_HW_CACHE, HardwareCacheConfig(PERF_COUNT_HW_CACHE_DTLB));
+	}
+
+	CounterGroup::~CounterGroup()
+	{
+		for (auto fd : m_fds)
+		{
+			if (fd >= 0)
+				close(fd);
+		}
+	}
+
+	Sample CounterGroup::Read() const
+	{
+		Sample sample;
+		for (int i = 0; i < NumCounters; ++i)
+		{
+			uint64_t data[3] = {}; // value, time enabled, time running
+			if (m_fds[i] < 0 || read(m_fds[i], data, sizeof(data)) != sizeof(data))
+				continue;
+
+			sample.available[i] = true;
+			sample.values[i] = (data[2] > 0 && data[2] < data[1])
+				? static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2])
+				: data[0];
+		}
+		return sample;
+	}
+
+#else
+
+	CounterGroup::CounterGroup()
+	{
+		m_fds.fill(-1);
+	}
+
+	CounterGroup::~CounterGroup()
+	{
+	}
+
+	Sample CounterGroup::Read() const
+	{
+		return Sample();
+	}
+
+#endif
+
+	bool CounterGroup::IsAnyAvailable() const
+	{
+		for (auto fd : m_fds)
+		{
+			if (fd >= 0)
+				return true;
+		}
+		return false;
+	}
+}
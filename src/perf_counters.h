@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Hardware performance counters for the calling thread, read directly through Linux perf_event_open. Elsewhere, or
+// when the kernel refuses access (see /proc/sys/kernel/perf_event_paranoid), counters are simply unavailable.
+namespace PerfCounters
+{
+	enum Counter
+	{
+		Cycles,
+		Instructions,
+		BranchMisses,
+		L1DCacheMisses,
+		LLCMisses,
+		DTLBMisses,
+		NumCounters
+	};
+
+	const char* GetCounterName(Counter counter);
+
+	struct Sample
+	{
+		std::array<uint64_t, NumCounters> values{};
+		std::array<bool, NumCounters> available{};
+	};
+
+	// Difference between two samples; a counter is only available if it was in both
+	Sample operator-(const Sample& end, const Sample& start);
+
+	class CounterGroup
+	{
+	public:
+		CounterGroup();
+		~CounterGroup();
+
+		CounterGroup(const CounterGroup&) = delete;
+		CounterGroup& operator=(const CounterGroup&) = delete;
+
+		bool IsAnyAvailable() const;
+
+		// Cumulative counts since construction, scaled up if the kernel had to multiplex counters
+		Sample Read() const;
+
+	private:
+		std::array<int, NumCounters> m_fds;
+	};
+}
@@ -0,0 +1,240 @@
+#include "pipeline.h"
+#include "stats.h"
+#include "trace.h"
+#include "ast_image.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+namespace
+{
+	template <typename PhaseFunc>
+	void RunPhase(const char* name, Stats::CompileStats* stats, const PerfCounters::CounterGroup* counters, PhaseFunc phaseFunc)
+	{
+		if (stats)
+		{
+			Stats::PhaseTimer timer(*stats, name, counters);
+			phaseFunc();
+		}
+		else
+		{
+			Trace::Scope scope("phase", name);
+			phaseFunc();
+		}
+	}
+
+	LispAst::NodeUniquePtr ParseLisp(const std::string& lispCode, std::vector<Token>& tokens, const CompileOptions& options, Stats::CompileStats* stats, const PerfCounters::CounterGroup* counters)
+	{
+		LispAst::NodeUniquePtr lispAst;
+		if (!options.astCacheDirectory.empty())
+			RunPhase("LoadAstImage", stats, counters, [&] { lispAst = AstImage::FindCachedLispAst(options.astCacheDirectory, lispCode, options.parse); });
+
+		if (!lispAst)
+		{
+			RunPhase("Tokenize", stats, counters, [&] { Tokenize(lispCode, tokens); });
+			RunPhase("Parse", stats, counters, [&] { lispAst = LispAst::Parse(tokens, options.parse); });
+			if (stats)
+				stats->tokenCount = tokens.size();
+
+			// Before the optimizations, which depend on options that aren't part of the cache key. Failing to cache
+			// doesn't fail the compile.
+			if (!options.astCacheDirectory.empty())
+			{
+				RunPhase("SaveAstImage", stats, counters, [&]
+				{
+					try
+					{
+						AstImage::CacheLispAst(options.astCacheDirectory, lispCode, options.parse, lispAst);
+					}
+					catch (const std::runtime_error&)
+					{
+					}
+				});
+			}
+		}
+
+		if (stats)
+		{
+			stats->inputBytes = lispCode.size();
+			stats->lispNodeCount = Stats::CountLispNodes(lispAst);
+		}
+
+		if (options.foldConstants)
+		{
+			ConstantFolding::Result foldResult;
+			RunPhase("ConstantFolding", stats, counters, [&] { foldResult = ConstantFolding::FoldConstants(lispAst, options.fold); });
+			if (stats)
+				stats->foldedNodeCount = foldResult.nodesEliminated;
+		}
+
+		return lispAst;
+	}
+
+	void GenerateCpp(const std::string& lispCode, std::vector<Token>& tokens, const CompileOptions& options, Stats::CompileStats* stats, const PerfCounters::CounterGroup* counters, std::ostream& os)
+	{
+		auto lispAst = ParseLisp(lispCode, tokens, options, stats, counters);
+
+		CppAst::NodeUniquePtr cppAst;
+		RunPhase("Transform", stats, counters, [&] { cppAst = TransformLispAstToCppAst(std::move(lispAst)); });
+
+		if (options.eliminateCommonSubexpressions)
+			RunPhase("CommonSubexpressions", stats, counters, [&] { CommonSubexpressions::EliminateCommonSubexpressions(cppAst, options.cse); });
+
+		if (stats)
+			stats->cppNodeCount = Stats::CountCppNodes(cppAst);
+
+		RunPhase("GenerateCppCode", stats, counters, [&] { GenerateCppCode(cppAst, options.codeGen, os); });
+	}
+
+	std::vector<Interpreter::Value> Evaluate(const std::string& lispCode, std::vector<Token>& tokens, const CompileOptions& options, Stats::CompileStats* stats, const PerfCounters::CounterGroup* counters)
+	{
+		auto lispAst = ParseLisp(lispCode, tokens, options, stats, counters);
+
+		std::vector<Interpreter::Value> results;
+		if (options.backend == Backend::Bytecode)
+		{
+			Bytecode::Program program;
+			RunPhase("CompileBytecode", stats, counters, [&] { program = Bytecode::Compile(lispAst, *options.natives); });
+			RunPhase("Execute", stats, counters, [&] { results = Bytecode::Execute(program); });
+		}
+		else if (options.backend == Backend::Jit && Jit::IsSupported() && Jit::CanCompile(lispAst))
+		{
+			Jit::Program program;
+			RunPhase("CompileMachineCode", stats, counters, [&] { program = Jit::Compile(lispAst, *options.natives); });
+			RunPhase("Execute", stats, counters, [&] { results = Jit::Execute(program); });
+		}
+		else
+		{
+			RunPhase("Evaluate", stats, counters, [&] { results = Interpreter::Evaluate(lispAst, *options.natives); });
+		}
+		return results;
+	}
+}
+
+std::string CompileToCpp(const std::string& lispCode, const CompileOptions& options, Stats::CompileStats* stats, const PerfCounters::CounterGroup* counters)
+{
+	return CompilerContext().CompileToCpp(lispCode, options, stats, counters);
+}
+
+std::vector<Interpreter::Value> EvaluateLisp(const std::string& lispCode, const CompileOptions& options, Stats::CompileStats* stats, const PerfCounters::CounterGroup* counters)
+{
+	std::vector<Token> tokens;
+	return Evaluate(lispCode, tokens, options, stats, counters);
+}
+
+std::string RunPipeline(const std::string& lispCode, const CompileOptions& options, Stats::CompileStats* stats, const PerfCounters::CounterGroup* counters)
+{
+	return CompilerContext().RunPipeline(lispCode, options, stats, counters);
+}
+
+CompilerContext::CompilerContext()
+	: m_outputStream(&m_outputBuffer)
+{
+}
+
+const std::string& CompilerContext::CompileToCpp(const std::string& lispCode, const CompileOptions& options, Stats::CompileStats* stats, const PerfCounters::CounterGroup* counters)
+{
+	GenerateCpp(lispCode, m_tokens, options, stats, counters, OpenOutput());
+	TrimRetainedMemory();
+
+	const auto& cppCode = CloseOutput();
+	if (stats)
+		stats->outputBytes = cppCode.size();
+	return cppCode;
+}
+
+const std::string& CompilerContext::RunPipeline(const std::string& lispCode, const CompileOptions& options, Stats::CompileStats* stats, const PerfCounters::CounterGroup* counters)
+{
+	if (options.backend == Backend::Cpp)
+		return CompileToCpp(lispCode, options, stats, counters);
+
+	const auto values = Evaluate(lispCode, m_tokens, options, stats, counters);
+	TrimRetainedMemory();
+
+	auto& os = OpenOutput();
+	for (auto&& value : values)
+		os << value << '\n';
+
+	const auto& output = CloseOutput();
+	if (stats)
+		stats->outputBytes = output.size();
+	return output;
+}
+
+void CompilerContext::TrimRetainedMemory()
+{
+	CommonAst::NodeAllocator::Trim(MaxRetainedBytes);
+	if (m_tokens.capacity() * sizeof(Token) > MaxRetainedBytes)
+		std::vector<Token>().swap(m_tokens);
+}
+
+std::ostream& CompilerContext::OpenOutput()
+{
+	// The previous output is no longer in use, so this is the time to let go of an oversized one
+	if (m_output.capacity() > MaxRetainedBytes)
+		std::string().swap(m_output);
+	m_outputBuffer.Open(m_output);
+	m_outputStream.clear();
+	return m_outputStream;
+}
+
+const std::string& CompilerContext::CloseOutput()
+{
+	m_outputBuffer.Close();
+	return m_output;
+}
+
+// The put area spans the whole string, including the unused part of its capacity; Close trims it to what was written
+void CompilerContext::StringOutputBuffer::Open(std::string& output)
+{
+	m_output = &output;
+	m_output->resize(m_output->capacity());
+	SetPutArea(0);
+}
+
+void CompilerContext::StringOutputBuffer::Close()
+{
+	m_output->resize(static_cast<size_t>(pptr() - pbase()));
+	setp(nullptr, nullptr);
+	m_output = nullptr;
+}
+
+CompilerContext::StringOutputBuffer::int_type CompilerContext::StringOutputBuffer::overflow(int_type c)
+{
+	if (traits_type::eq_int_type(c, traits_type::eof()))
+		return traits_type::not_eof(c);
+
+	const auto used = static_cast<size_t>(pptr() - pbase());
+	m_output->resize(std::max<size_t>(m_output->size() * 2, 256));
+	SetPutArea(used);
+
+	*pptr() = traits_type::to_char_type(c);
+	pbump(1);
+	return c;
+}
+
+std::streamsize CompilerContext::StringOutputBuffer::xsputn(const char_type* s, std::streamsize count)
+{
+	const auto used = static_cast<size_t>(pptr() - pbase());
+	const auto size = static_cast<size_t>(count);
+	if (used + size > m_output->size())
+		m_output->resize(std::max(m_output->size() * 2, used + size));
+
+	std::memcpy(&(*m_output)[used], s, size);
+	SetPutArea(used + size);
+	return count;
+}
+
+void CompilerContext::StringOutputBuffer::SetPutArea(size_t used)
+{
+	auto base = &(*m_output)[0];
+	setp(base, base + m_output->size());
+
+	// pbump only takes an int
+	while (used > 0)
+	{
+		const auto step = static_cast<int>(std::min<size_t>(used, INT_MAX));
+		pbump(step);
+		used -= static_cast<size_t>(step);
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <streambuf>
+#include "compiler.h"
+#include "constant_folding.h"
+#include "common_subexpressions.h"
+#include "interpreter.h"
+#include "bytecode.h"
+#include "jit.h"
+
+namespace Stats { struct CompileStats; }
+namespace PerfCounters { class CounterGroup; }
+
+enum class Backend
+{
+	Cpp,			// Generate C++ code
+	Interpreter,	// Evaluate the program with Interpreter::Evaluate
+	Bytecode,		// Evaluate the program by compiling it to bytecode and running it with Bytecode::Execute
+	Jit,			// Evaluate the program by compiling it to machine code, or with the interpreter if Jit::IsSupported() or Jit::CanCompile() is false
+};
+
+struct CompileOptions
+{
+	Backend backend = Backend::Cpp;
+
+	LispAst::ParseOptions parse;
+	std::string astCacheDirectory; // If set, parsed ASTs are cached there as images (see AstImage::FindCachedLispAst)
+
+	bool foldConstants = false;
+	ConstantFolding::Options fold = ConstantFolding::Options::Default();
+
+	bool eliminateCommonSubexpressions = false;
+	CommonSubexpressions::Options cse;
+
+	CodeGenOptions codeGen;
+
+	const Interpreter::NativeRegistry* natives = &Interpreter::NativeRegistry::Default(); // Functions the program may call when evaluated
+};
+
+// Runs the full pipeline (tokenize, parse, optimize, transform, generate) and returns the generated C++ code. Each
+// phase is recorded in the trace, and also in stats if given (with hardware counters, if given).
+std::string CompileToCpp(const std::string& lispCode, const CompileOptions& options = CompileOptions(),
+	Stats::CompileStats* stats = nullptr, const PerfCounters::CounterGroup* counters = nullptr);
+
+// Tokenizes, parses and optimizes lispCode, then evaluates it, returning the value of each top-level form
+std::vector<Interpreter::Value> EvaluateLisp(const std::string& lispCode, const CompileOptions& options = CompileOptions(),
+	Stats::CompileStats* stats = nullptr, const PerfCounters::CounterGroup* counters = nullptr);
+
+// Runs the backend selected by options.backend and returns its output: the generated C++ code, or the value of each
+// top-level form on its own line
+std::string RunPipeline(const std::string& lispCode, const CompileOptions& options,
+	Stats::CompileStats* stats = nullptr, const PerfCounters::CounterGroup* counters = nullptr);
+
+// Keeps the buffers of the pipeline (tokens, generated output) between compilations, clearing them without giving their
+// memory back. AST nodes are recycled per thread (see CommonAst::Node), so after a warm-up, compiling inputs of similar
+// size through the same context barely allocates. Each buffer, and the calling thread's recycled nodes, are trimmed
+// back to MaxRetainedBytes after a compile, so one huge input doesn't pin its peak memory in a long-running process.
+// Not thread-safe; use one context per thread.
+class CompilerContext
+{
+public:
+	static const size_t MaxRetainedBytes = 16 * 1024 * 1024;
+
+	CompilerContext();
+	CompilerContext(const CompilerContext&) = delete;
+	CompilerContext& operator=(const CompilerContext&) = delete;
+
+	// Same as the free functions, but the returned string is owned by the context and valid until its next use
+	const std::string& CompileToCpp(const std::string& lispCode, const CompileOptions& options = CompileOptions(),
+		Stats::CompileStats* stats = nullptr, const PerfCounters::CounterGroup* counters = nullptr);
+	const std::string& RunPipeline(const std::string& lispCode, const CompileOptions& options,
+		Stats::CompileStats* stats = nullptr, const PerfCounters::CounterGroup* counters = nullptr);
+
+private:
+	// Writes directly into a string, growing it as needed; unlike std::ostringstream, the string keeps its capacity
+	class StringOutputBuffer : public std::streambuf
+	{
+	public:
+		void Open(std::string& output);
+		void Close();
+
+	protected:
+		int_type overflow(int_type c) override;
+		std::streamsize xsputn(const char_type* s, std::streamsize count) override;
+
+	private:
+		void SetPutArea(size_t used);
+
+		std::string* m_output = nullptr;
+	};
+
+	void TrimRetainedMemory();
+	std::ostream& OpenOutput();
+	const std::string& CloseOutput();
+
+	std::vector<Token> m_tokens;
+	std::string m_output;
+	StringOutputBuffer m_outputBuffer;
+	std::ostream m_outputStream;
+};
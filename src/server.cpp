@@ -0,0 +1,358 @@
+#include "server.h"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#endif
+
+namespace Server
+{
+#if defined(__unix__) || defined(__APPLE__)
+	namespace
+	{
+		// Wire format: a message is a field count followed by length-prefixed fields (all lengths uint32, host order).
+		// Requests are [cwd, stdin, args...], responses are [exit code, stdout, stderr].
+		const uint32_t MaxFieldCount = 1 << 16;
+		const uint32_t MaxFieldSize = 1 << 28;
+
+		// Requests are served one at a time, so a client that stalls mid-message is dropped rather than allowed to
+		// block every other client
+		const int IoTimeoutSeconds = 5;
+
+		volatile sig_atomic_t g_stopRequested = 0;
+
+		void OnStopSignal(int)
+		{
+			g_stopRequested = 1;
+		}
+
+		bool WriteAll(int fd, const void* data, size_t size)
+		{
+			auto bytes = static_cast<const char*>(data);
+			while (size > 0)
+			{
+				const auto written = write(fd, bytes, size);
+				if (written < 0 && errno == EINTR)
+					continue;
+				if (written <= 0)
+					return false;
+				bytes += written;
+				size -= written;
+			}
+			return true;
+		}
+
+		bool ReadAll(int fd, void* data, size_t size)
+		{
+			auto bytes = static_cast<char*>(data);
+			while (size > 0)
+			{
+				const auto numRead = read(fd, bytes, size);
+				if (numRead < 0 && errno == EINTR)
+					continue;
+				if (numRead <= 0)
+					return false;
+				bytes += numRead;
+				size -= numRead;
+			}
+			return true;
+		}
+
+		bool SendMessage(int fd, const std::vector<std::string>& fields, std::string& buffer)
+		{
+			auto AppendUInt32 = [&buffer](uint32_t value)
+			{
+				buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+			};
+
+			buffer.clear();
+			AppendUInt32(static_cast<uint32_t>(fields.size()));
+			for (auto&& field : fields)
+			{
+				AppendUInt32(static_cast<uint32_t>(field.size()));
+				buffer += field;
+			}
+			return WriteAll(fd, buffer.data(), buffer.size());
+		}
+
+		// Fields are resized in place so that a reused vector keeps its string capacity across messages
+		bool ReceiveMessage(int fd, std::vector<std::string>& fields)
+		{
+			uint32_t count = 0;
+			if (!ReadAll(fd, &count, sizeof(count)) || count > MaxFieldCount)
+				return false;
+
+			fields.resize(count);
+			for (auto&& field : fields)
+			{
+				uint32_t size = 0;
+				if (!ReadAll(fd, &size, sizeof(size)) || size > MaxFieldSize)
+					return false;
+				field.resize(size);
+				if (size > 0 && !ReadAll(fd, &field[0], size))
+					return false;
+			}
+			return true;
+		}
+
+		bool MakeAddress(const std::string& socketPath, sockaddr_un& addr)
+		{
+			std::memset(&addr, 0, sizeof(addr));
+			addr.sun_family = AF_UNIX;
+			if (socketPath.empty() || socketPath.size() >= sizeof(addr.sun_path))
+			{
+				std::cerr << "Invalid socket path: " << socketPath << '\n';
+				return false;
+			}
+			std::memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+			return true;
+		}
+
+		std::string GetCurrentDirectory()
+		{
+			std::vector<char> buffer(256);
+			while (getcwd(buffer.data(), buffer.size()) == nullptr)
+			{
+				if (errno != ERANGE)
+					return std::string();
+				buffer.resize(buffer.size() * 2);
+			}
+			return buffer.data();
+		}
+
+		// Keeps the most recent request latencies and reports nearest-rank percentiles over them
+		class LatencyRecorder
+		{
+		public:
+			void Add(double microseconds)
+			{
+				if (m_samples.size() < MaxSamples)
+					m_samples.push_back(microseconds);
+				else
+					m_samples[m_totalCount % MaxSamples] = microseconds;
+				++m_totalCount;
+			}
+
+			std::string Summary() const
+			{
+				std::ostringstream os;
+				os << "requests: " << m_totalCount;
+				if (!m_samples.empty())
+				{
+					auto sorted = m_samples;
+					std::sort(sorted.begin(), sorted.end());
+					auto Percentile = [&sorted](double p)
+					{
+						const auto rank = static_cast<size_t>(p * sorted.size() + 0.999999);
+						return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+					};
+					os << ", p50: " << Percentile(0.50) << " us"
+						<< ", p99: " << Percentile(0.99) << " us"
+						<< ", max: " << sorted.back() << " us";
+				}
+				os << '\n';
+				return os.str();
+			}
+
+		private:
+			static const size_t MaxSamples = 100000;
+			std::vector<double> m_samples;
+			size_t m_totalCount = 0;
+		};
+	}
+
+	int Run(const std::string& socketPath, const CommandHandler& handler)
+	{
+		// Requests chdir to the client's directory, so remember where a relative socket path lives
+		const auto absoluteSocketPath = (!socketPath.empty() && socketPath[0] == '/') ? socketPath : GetCurrentDirectory() + "/" + socketPath;
+
+		sockaddr_un addr;
+		if (!MakeAddress(absoluteSocketPath, addr))
+			return 1;
+
+		struct sigaction stopAction;
+		std::memset(&stopAction, 0, sizeof(stopAction));
+		stopAction.sa_handler = OnStopSignal; // No SA_RESTART: we want accept() to return on a signal
+		sigaction(SIGINT, &stopAction, nullptr);
+		sigaction(SIGTERM, &stopAction, nullptr);
+		signal(SIGPIPE, SIG_IGN);
+
+		const int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listenFd < 0)
+		{
+			std::perror("socket");
+			return 1;
+		}
+
+		unlink(absoluteSocketPath.c_str()); // Remove a stale socket left behind by a previous server
+		if (bind(listenFd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listenFd, SOMAXCONN) < 0)
+		{
+			std::perror("bind/listen");
+			close(listenFd);
+			return 1;
+		}
+
+		std::cerr << "TinyCompiler server listening on " << absoluteSocketPath << '\n';
+
+		// Per-request buffers live for the whole server lifetime so their capacity is reused
+		LatencyRecorder latencies;
+		std::vector<std::string> request;
+		std::vector<std::string> response(3);
+		std::vector<std::string> args;
+		std::string sendBuffer;
+		bool running = true;
+
+		while (running && !g_stopRequested)
+		{
+			const int fd = accept(listenFd, nullptr, nullptr);
+			if (fd < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				std::perror("accept");
+				break;
+			}
+
+			// A read or write that times out fails, and the connection is closed
+			timeval timeout;
+			timeout.tv_sec = IoTimeoutSeconds;
+			timeout.tv_usec = 0;
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+			const auto startTime = std::chrono::steady_clock::now();
+			bool isCompileRequest = false;
+
+			if (ReceiveMessage(fd, request) && request.size() >= 2)
+			{
+				args.assign(request.begin() + 2, request.end());
+
+				if (args.size() == 1 && args[0] == "--server-stats")
+				{
+					response[0] = "0";
+					response[1] = latencies.Summary();
+					response[2].clear();
+				}
+				else if (args.size() == 1 && args[0] == "--server-stop")
+				{
+					running = false;
+					response[0] = "0";
+					response[1] = "Server stopping\n";
+					response[2].clear();
+				}
+				else
+				{
+					isCompileRequest = true;
+					std::istringstream in(request[1]);
+					std::ostringstream out;
+					std::ostringstream err;
+					int exitCode = 1;
+					if (chdir(request[0].c_str()) < 0)
+					{
+						err << "Server cannot access directory " << request[0] << '\n';
+					}
+					else
+					{
+						try
+						{
+							exitCode = handler(args, in, out, err);
+						}
+						catch (const std::exception& e)
+						{
+							err << "error: " << e.what() << '\n';
+						}
+					}
+					response[0] = std::to_string(exitCode);
+					response[1] = out.str();
+					response[2] = err.str();
+				}
+
+				SendMessage(fd, response, sendBuffer);
+			}
+
+			close(fd);
+
+			if (isCompileRequest)
+			{
+				const auto elapsed = std::chrono::steady_clock::now() - startTime;
+				latencies.Add(std::chrono::duration<double, std::micro>(elapsed).count());
+			}
+		}
+
+		close(listenFd);
+		unlink(absoluteSocketPath.c_str());
+		std::cerr << "TinyCompiler server stopped, " << latencies.Summary();
+		return 0;
+	}
+
+	int RunClient(const std::string& socketPath, const std::vector<std::string>& args)
+	{
+		sockaddr_un addr;
+		if (!MakeAddress(socketPath, addr))
+			return 1;
+
+		const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0)
+		{
+			std::perror("connect");
+			if (fd >= 0)
+				close(fd);
+			return 1;
+		}
+
+		std::vector<std::string> request;
+		request.reserve(args.size() + 2);
+		request.push_back(GetCurrentDirectory());
+		request.emplace_back();
+		if (std::find(args.begin(), args.end(), "-") != args.end())
+		{
+			std::ostringstream stdinContents;
+			stdinContents << std::cin.rdbuf();
+			request.back() = stdinContents.str();
+		}
+		request.insert(request.end(), args.begin(), args.end());
+
+		signal(SIGPIPE, SIG_IGN);
+
+		std::string sendBuffer;
+		std::vector<std::string> response;
+		const bool ok = SendMessage(fd, request, sendBuffer) && ReceiveMessage(fd, response) && response.size() == 3;
+		close(fd);
+
+		if (!ok)
+		{
+			std::cerr << "Lost connection to server at " << socketPath << '\n';
+			return 1;
+		}
+
+		std::cout << response[1] << std::flush;
+		std::cerr << response[2] << std::flush;
+		return std::atoi(response[0].c_str());
+	}
+
+#else
+
+	int Run(const std::string&, const CommandHandler&)
+	{
+		std::cerr << "--server is only supported on platforms with Unix domain sockets\n";
+		return 1;
+	}
+
+	int RunClient(const std::string&, const std::vector<std::string>&)
+	{
+		std::cerr << "--client is only supported on platforms with Unix domain sockets\n";
+		return 1;
+	}
+
+#endif
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <functional>
+
+// Persistent compile server. A long-running process listens on a Unix domain socket and runs forwarded command
+// lines, so repeated invocations skip process startup and run against an already warm heap.
+namespace Server
+{
+	using CommandHandler = std::function<int(const std::vector<std::string>& args, std::istream& in, std::ostream& out, std::ostream& err)>;
+
+	// Serves requests on socketPath until a --server-stop request or SIGINT/SIGTERM. Returns the process exit code.
+	int Run(const std::string& socketPath, const CommandHandler& handler);
+
+	// Forwards args (and stdin, if any arg is "-") to the server, relays its output and returns its exit code.
+	int RunClient(const std::string& socketPath, const std::vector<std::string>& args);
+}
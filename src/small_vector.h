@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <cassert>
+
+// Default source of the heap storage a SmallVector grows into
+struct SmallVectorHeapAllocator
+{
+	static void* Allocate(size_t size) { return ::operator new(size); }
+	static void Free(void* p, size_t) { ::operator delete(p); }
+};
+
+// Vector that stores up to InlineCapacity elements inside itself, only allocating when it grows beyond that. Supports
+// the subset of std::vector that the ASTs need, including move-only element types.
+template <typename T, size_t InlineCapacity, typename Allocator = SmallVectorHeapAllocator>
+class SmallVector
+{
+public:
+	using value_type = T;
+	using iterator = T*;
+	using const_iterator = const T*;
+
+	SmallVector() = default;
+
+	SmallVector(SmallVector&& other)
+	{
+		MoveFrom(other);
+	}
+
+	SmallVector& operator=(SmallVector&& other)
+	{
+		if (this != &other)
+		{
+			clear();
+			FreeHeap();
+			MoveFrom(other);
+		}
+		return *this;
+	}
+
+	SmallVector(const SmallVector&) = delete;
+	SmallVector& operator=(const SmallVector&) = delete;
+
+	~SmallVector()
+	{
+		clear();
+		FreeHeap();
+	}
+
+	T* begin() { return m_data; }
+	T* end() { return m_data + m_size; }
+	const T* begin() const { return m_data; }
+	const T* end() const { return m_data + m_size; }
+
+	T* data() { return m_data; }
+	const T* data() const { return m_data; }
+
+	size_t size() const { return m_size; }
+	size_t capacity() const { return m_capacity; }
+	bool empty() const { return m_size == 0; }
+
+	T& operator[](size_t index) { assert(index < m_size); return m_data[index]; }
+	const T& operator[](size_t index) const { assert(index < m_size); return m_data[index]; }
+
+	T& back() { assert(m_size > 0); return m_data[m_size - 1]; }
+	const T& back() const { assert(m_size > 0); return m_data[m_size - 1]; }
+
+	template <typename... Args>
+	T& emplace_back(Args&&... args)
+	{
+		if (m_size == m_capacity)
+			Grow(m_capacity * 2);
+		T* element = new (m_data + m_size) T(std::forward<Args>(args)...);
+		++m_size;
+		return *element;
+	}
+
+	void push_back(T&& value) { emplace_back(std::move(value)); }
+	void push_back(const T& value) { emplace_back(value); }
+
+	void pop_back()
+	{
+		assert(m_size > 0);
+		m_data[--m_size].~T();
+	}
+
+	void reserve(size_t capacity)
+	{
+		if (capacity > m_capacity)
+			Grow(capacity);
+	}
+
+	// Destroys the elements but keeps the capacity
+	void clear()
+	{
+		for (size_t i = 0; i < m_size; ++i)
+			m_data[i].~T();
+		m_size = 0;
+	}
+
+private:
+	T* InlineData() { return reinterpret_cast<T*>(m_inline); }
+	bool IsInline() const { return m_data == reinterpret_cast<const T*>(m_inline); }
+
+	void Grow(size_t capacity)
+	{
+		T* data = static_cast<T*>(Allocator::Allocate(capacity * sizeof(T)));
+		for (size_t i = 0; i < m_size; ++i)
+		{
+			new (data + i) T(std::move(m_data[i]));
+			m_data[i].~T();
+		}
+		FreeHeap();
+		m_data = data;
+		m_capacity = capacity;
+	}
+
+	void FreeHeap()
+	{
+		if (!IsInline())
+			Allocator::Free(m_data, m_capacity * sizeof(T));
+		m_data = InlineData();
+		m_capacity = InlineCapacity;
+	}
+
+	// Expects this to be empty with inline storage. Heap storage is stolen; inline elements have to be moved.
+	void MoveFrom(SmallVector& other)
+	{
+		if (other.IsInline())
+		{
+			for (size_t i = 0; i < other.m_size; ++i)
+				new (m_data + i) T(std::move(other.m_data[i]));
+			m_size = other.m_size;
+			other.clear();
+		}
+		else
+		{
+			m_data = other.m_data;
+			m_size = other.m_size;
+			m_capacity = other.m_capacity;
+			other.m_data = other.InlineData();
+			other.m_size = 0;
+			other.m_capacity = InlineCapacity;
+		}
+	}
+
+	static_assert(InlineCapacity > 0, "SmallVector needs inline capacity; use std::vector otherwise");
+
+	T* m_data = InlineData();
+	size_t m_size = 0;
+	size_t m_capacity = InlineCapacity;
+	alignas(T) unsigned char m_inline[InlineCapacity * sizeof(T)];
+};
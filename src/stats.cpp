@@ -0,0 +1,269 @@
+#include "stats.h"
+#include <iomanip>
+#include <memory>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace Stats
+{
+	namespace
+	{
+		size_t CountLispNodesImpl(const LispAst::NodeUniquePtr& lispAst)
+		{
+			struct NodeCounter : LispAst::Visitor
+			{
+				size_t count = 0;
+				virtual void OnVisit(const LispAst::ProgramNode&, int) { ++count; }
+				virtual void OnVisit(const LispAst::CallExpressionNode&, const LispAst::Node&, int) { ++count; }
+				virtual void OnVisit(const LispAst::NumberLiteralNode&, const LispAst::Node&, int) { ++count; }
+				virtual void OnVisit(const LispAst::CallExpressionRefNode&, const LispAst::Node&, int) { ++count; }
+				virtual void OnVisitLiteral(int, const LispAst::CallExpressionNode&, int) {} // Stored inline, not a node
+			};
+
+			auto counter = NodeCounter();
+			LispAst::Visit(lispAst, nullptr, counter);
+			return counter.count;
+		}
+
+		size_t CountCppNodesImpl(const CppAst::NodeUniquePtr& cppAst)
+		{
+			using namespace CppAst;
+
+			size_t count = 0;
+			std::vector<const Node*> stack{ cppAst.get() };
+			while (!stack.empty())
+			{
+				const auto current = stack.back();
+				stack.pop_back();
+				++count;
+
+				if (auto node = AsNodePtr<const ProgramNode*>(current))
+				{
+					for (auto&& bodyNode : node->body)
+						stack.push_back(bodyNode.get());
+				}
+				else if (auto node = AsNodePtr<const ExpressionStatementNode*>(current))
+				{
+					stack.push_back(node->expression.get());
+				}
+				else if (auto node = AsNodePtr<const VariableDeclarationNode*>(current))
+				{
+					stack.push_back(node->name.get());
+					stack.push_back(node->initializer.get());
+				}
+				else if (auto node = AsNodePtr<const CallExpressionNode*>(current))
+				{
+					stack.push_back(node->callee.get());
+					for (auto&& param : node->params)
+					{
+						if (!param.IsLiteral()) // Stored inline, not a node
+							stack.push_back(param.GetNode());
+					}
+				}
+			}
+			return count;
+		}
+
+		std::string EscapeJson(const std::string& s)
+		{
+			std::string result;
+			for (char c : s)
+			{
+				if (c == '"' || c == '\\')
+				{
+					result += '\\';
+					result += c;
+				}
+				else if (static_cast<unsigned char>(c) < 0x20)
+				{
+					const char* hex = "0123456789abcdef";
+					result += "\\u00";
+					result += hex[(c >> 4) & 0xf];
+					result += hex[c & 0xf];
+				}
+				else
+				{
+					result += c;
+				}
+			}
+			return result;
+		}
+	}
+
+	size_t CountLispNodes(const LispAst::NodeUniquePtr& lispAst)
+	{
+		return CountLispNodesImpl(lispAst);
+	}
+
+	size_t CountCppNodes(const CppAst::NodeUniquePtr& cppAst)
+	{
+		return CountCppNodesImpl(cppAst);
+	}
+
+	size_t GetPeakRssKb()
+	{
+#if defined(__APPLE__)
+		rusage usage;
+		return getrusage(RUSAGE_SELF, &usage) == 0 ? static_cast<size_t>(usage.ru_maxrss) / 1024 : 0; // Bytes on macOS
+#elif defined(__unix__)
+		rusage usage;
+		return getrusage(RUSAGE_SELF, &usage) == 0 ? static_cast<size_t>(usage.ru_maxrss) : 0;
+#else
+		return 0;
+#endif
+	}
+
+	PhaseTimer::PhaseTimer(CompileStats& stats, const char* name, const PerfCounters::CounterGroup* counters)
+		: m_traceScope("phase", name)
+		, m_stats(stats)
+		, m_name(name)
+		, m_startAllocations(GetAllocationCounters())
+		, m_startTime(std::chrono::steady_clock::now())
+		, m_counters(counters)
+	{
+		// Last, so our own bookkeeping stays out of the counts
+		if (m_counters)
+			m_startCounters = m_counters->Read();
+	}
+
+	PhaseTimer::~PhaseTimer()
+	{
+		const auto counters = m_counters ? m_counters->Read() - m_startCounters : PerfCounters::Sample();
+		const auto elapsed = std::chrono::steady_clock::now() - m_startTime;
+		const auto allocations = GetAllocationCounters();
+		m_stats.phases.push_back(PhaseStats{
+			m_name,
+			std::chrono::duration<double, std::milli>(elapsed).count(),
+			allocations.bytes - m_startAllocations.bytes,
+			allocations.count - m_startAllocations.count,
+			GetPeakRssKb(),
+			counters
+		});
+	}
+
+	void CompileWithStats(CompilerContext& context, const std::string& lispCode, const CompileOptions& options, std::ostream& out, CompileStats& stats)
+	{
+		std::unique_ptr<PerfCounters::CounterGroup> counters;
+		if (stats.collectHardwareCounters)
+		{
+			counters = std::make_unique<PerfCounters::CounterGroup>();
+			stats.hardwareCountersAvailable = counters->IsAnyAvailable();
+			if (!stats.hardwareCountersAvailable)
+				counters.reset();
+		}
+
+		const auto& output = context.RunPipeline(lispCode, options, &stats, counters.get());
+
+		{
+			PhaseTimer timer(stats, "Output", counters.get());
+			out << output << std::flush;
+		}
+	}
+
+	void PrintText(const CompileStats& stats, std::ostream& os)
+	{
+		os << "Stats for " << stats.inputName << ": "
+			<< stats.inputBytes << " bytes in, " << stats.outputBytes << " bytes out, "
+			<< stats.tokenCount << " tokens, " << stats.lispNodeCount << " Lisp nodes, " << stats.cppNodeCount << " C++ nodes";
+		if (stats.foldedNodeCount > 0)
+			os << ", " << stats.foldedNodeCount << " nodes eliminated by constant folding";
+		os << '\n';
+
+		os << "  " << std::left << std::setw(22) << "Phase" << std::right
+			<< std::setw(12) << "Time (ms)" << std::setw(14) << "Allocated (B)" << std::setw(10) << "Allocs" << std::setw(22) << "Process peak RSS (KB)" << '\n';
+
+		for (auto&& phase : stats.phases)
+		{
+			os << "  " << std::left << std::setw(22) << phase.name << std::right
+				<< std::setw(12) << std::fixed << std::setprecision(3) << phase.milliseconds << std::defaultfloat
+				<< std::setw(14) << phase.bytesAllocated << std::setw(10) << phase.allocationCount << std::setw(22) << phase.processPeakRssKb << '\n';
+		}
+
+		if (stats.collectHardwareCounters && !stats.hardwareCountersAvailable)
+		{
+			os << "  Hardware counters unavailable (check perf_event_paranoid)\n";
+		}
+		else if (stats.hardwareCountersAvailable)
+		{
+			using namespace PerfCounters;
+
+			// Per-token rates make phases comparable with each other and across input sizes
+			const double tokens = static_cast<double>(std::max<size_t>(stats.tokenCount, 1));
+			auto PrintRate = [&os](const Sample& counters, Counter counter, double divisor, int precision)
+			{
+				if (counters.available[counter] && divisor > 0)
+					os << std::setw(14) << std::fixed << std::setprecision(precision) << counters.values[counter] / divisor << std::defaultfloat;
+				else
+					os << std::setw(14) << "-";
+			};
+
+			os << "  " << std::left << std::setw(22) << "Phase" << std::right
+				<< std::setw(14) << "Cycles/token" << std::setw(14) << "IPC" << std::setw(14) << "BrMiss/token"
+				<< std::setw(14) << "L1DMiss/token" << std::setw(14) << "LLCMiss/token" << std::setw(14) << "TLBMiss/token" << '\n';
+
+			for (auto&& phase : stats.phases)
+			{
+				const auto& counters = phase.counters;
+				const double cycles = counters.available[Cycles] ? static_cast<double>(counters.values[Cycles]) : 0;
+				os << "  " << std::left << std::setw(22) << phase.name << std::right;
+				PrintRate(counters, Cycles, tokens, 1);
+				PrintRate(counters, Instructions, cycles, 2);
+				PrintRate(counters, BranchMisses, tokens, 3);
+				PrintRate(counters, L1DCacheMisses, tokens, 3);
+				PrintRate(counters, LLCMisses, tokens, 3);
+				PrintRate(counters, DTLBMisses, tokens, 3);
+				os << '\n';
+			}
+		}
+	}
+
+	void PrintJson(const std::vector<CompileStats>& allStats, std::ostream& os)
+	{
+		os << "[";
+		for (size_t i = 0; i < allStats.size(); ++i)
+		{
+			const auto& stats = allStats[i];
+			os << (i > 0 ? ",\n" : "\n")
+				<< "  {\"input\": \"" << EscapeJson(stats.inputName) << "\""
+				<< ", \"inputBytes\": " << stats.inputBytes
+				<< ", \"outputBytes\": " << stats.outputBytes
+				<< ", \"tokens\": " << stats.tokenCount
+				<< ", \"lispNodes\": " << stats.lispNodeCount
+				<< ", \"cppNodes\": " << stats.cppNodeCount
+				<< ", \"foldedNodes\": " << stats.foldedNodeCount
+				<< ", \"phases\": [";
+
+			for (size_t j = 0; j < stats.phases.size(); ++j)
+			{
+				const auto& phase = stats.phases[j];
+				os << (j > 0 ? ", " : "")
+					<< "{\"name\": \"" << phase.name << "\""
+					<< ", \"ms\": " << phase.milliseconds
+					<< ", \"bytesAllocated\": " << phase.bytesAllocated
+					<< ", \"allocations\": " << phase.allocationCount
+					<< ", \"processPeakRssKb\": " << phase.processPeakRssKb;
+
+				if (stats.hardwareCountersAvailable)
+				{
+					os << ", \"counters\": {";
+					const char* separator = "";
+					for (int c = 0; c < PerfCounters::NumCounters; ++c)
+					{
+						if (phase.counters.available[c])
+						{
+							os << separator << "\"" << PerfCounters::GetCounterName(static_cast<PerfCounters::Counter>(c)) << "\": " << phase.counters.values[c];
+							separator = ", ";
+						}
+					}
+					os << "}";
+				}
+				os << "}";
+			}
+			os << "]}";
+		}
+		os << "\n]\n";
+	}
+}
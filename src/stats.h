@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ostream>
+#include "trace.h"
+#include "perf_counters.h"
+#include "pipeline.h"
+
+// Per-phase compile instrumentation: wall time, heap allocations and the process peak RSS, plus sizes of the intermediate forms
+namespace Stats
+{
+	// Totals for the calling thread, maintained by the replacement global operator new in allocation_counters.cpp
+	struct AllocationCounters
+	{
+		size_t bytes;
+		size_t count;
+	};
+
+	AllocationCounters GetAllocationCounters();
+
+	// High-water mark of the process resident set size, or 0 where unsupported
+	size_t GetPeakRssKb();
+
+	struct PhaseStats
+	{
+		std::string name;
+		double milliseconds;
+		size_t bytesAllocated;
+		size_t allocationCount;
+		size_t processPeakRssKb; // Process-wide high-water mark at the end of the phase, not the phase's own use
+		PerfCounters::Sample counters;
+	};
+
+	struct CompileStats
+	{
+		std::string inputName;
+		bool collectHardwareCounters = false;
+		bool hardwareCountersAvailable = false;
+		std::vector<PhaseStats> phases;
+		size_t inputBytes = 0;
+		size_t outputBytes = 0;
+		size_t tokenCount = 0;
+		size_t lispNodeCount = 0;
+		size_t cppNodeCount = 0;
+		size_t foldedNodeCount = 0;
+	};
+
+	// Measures from construction to destruction and appends the result to stats.phases. Also records a trace scope.
+	class PhaseTimer
+	{
+	public:
+		PhaseTimer(CompileStats& stats, const char* name, const PerfCounters::CounterGroup* counters = nullptr);
+		~PhaseTimer();
+
+	private:
+		Trace::Scope m_traceScope; // First, so recording the trace events isn't counted in the phase
+		CompileStats& m_stats;
+		const char* m_name;
+		AllocationCounters m_startAllocations;
+		std::chrono::steady_clock::time_point m_startTime;
+		const PerfCounters::CounterGroup* m_counters;
+		PerfCounters::Sample m_startCounters;
+	};
+
+	// Runs the full pipeline on lispCode through context, writing its output (see RunPipeline) to out, and records each
+	// phase in stats. Hardware counters are collected on the calling thread if stats.collectHardwareCounters is set.
+	void CompileWithStats(CompilerContext& context, const std::string& lispCode, const CompileOptions& options, std::ostream& out, CompileStats& stats);
+
+	size_t CountLispNodes(const LispAst::NodeUniquePtr& lispAst);
+	size_t CountCppNodes(const CppAst::NodeUniquePtr& cppAst);
+
+	void PrintText(const CompileStats& stats, std::ostream& os);
+	void PrintJson(const std::vector<CompileStats>& allStats, std::ostream& os);
+}
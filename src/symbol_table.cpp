@@ -0,0 +1,168 @@
+#include "symbol_table.h"
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace SymbolTable
+{
+	namespace
+	{
+		// Names live in fixed-size chunks reached through a fixed-size array, so existing names never move and GetName
+		// can read them without taking the lock
+		const size_t ChunkBits = 12;
+		const size_t ChunkSize = size_t(1) << ChunkBits;
+		const size_t MaxChunks = size_t(1) << 12;
+
+		uint32_t Hash(const char* name, size_t length)
+		{
+			uint32_t hash = 2166136261u; // FNV-1a
+			for (size_t i = 0; i < length; ++i)
+				hash = (hash ^ static_cast<unsigned char>(name[i])) * 16777619u;
+			return hash;
+		}
+
+		class Table
+		{
+		public:
+			Table() : m_slots(1024, InvalidSymbol), m_size(0) {}
+
+			Symbol Intern(const char* name, size_t length)
+			{
+				const auto hash = Hash(name, length);
+				{
+					std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+					const auto symbol = m_slots[FindSlot(name, length, hash)];
+					if (symbol != InvalidSymbol)
+						return symbol;
+				}
+
+				std::unique_lock<std::shared_timed_mutex> lock(m_mutex);
+				auto slot = FindSlot(name, length, hash); // Another thread may have added it since
+				if (m_slots[slot] != InvalidSymbol)
+					return m_slots[slot];
+
+				const auto symbol = static_cast<Symbol>(m_size.load(std::memory_order_relaxed));
+				if (symbol >= ChunkSize * MaxChunks)
+					throw std::length_error("Too many distinct identifiers");
+
+				auto& chunk = m_chunks[symbol >> ChunkBits];
+				if (!chunk)
+					chunk.reset(new std::string[ChunkSize]);
+				chunk[symbol & (ChunkSize - 1)].assign(name, length);
+				m_hashes.push_back(hash);
+				m_slots[slot] = symbol;
+				m_size.store(symbol + 1, std::memory_order_release);
+
+				// Keep the load factor at or below one half
+				if (m_hashes.size() * 2 > m_slots.size())
+					Rehash(m_slots.size() * 2);
+
+				return symbol;
+			}
+
+			const std::string& GetName(Symbol symbol) const
+			{
+				assert(symbol < m_size.load(std::memory_order_acquire));
+				return m_chunks[symbol >> ChunkBits][symbol & (ChunkSize - 1)];
+			}
+
+			size_t Size() const
+			{
+				return m_size.load(std::memory_order_acquire);
+			}
+
+			void Truncate(size_t size)
+			{
+				std::unique_lock<std::shared_timed_mutex> lock(m_mutex);
+				const auto oldSize = m_size.load(std::memory_order_relaxed);
+				if (size >= oldSize)
+					return;
+
+				// Free the names, and the chunks that no longer hold any
+				for (size_t symbol = size; symbol < oldSize; ++symbol)
+					std::string().swap(m_chunks[symbol >> ChunkBits][symbol & (ChunkSize - 1)]);
+				for (size_t chunk = (size + ChunkSize - 1) >> ChunkBits; chunk < MaxChunks && m_chunks[chunk]; ++chunk)
+					m_chunks[chunk].reset();
+
+				m_hashes.resize(size);
+				m_hashes.shrink_to_fit();
+				m_size.store(size, std::memory_order_release);
+
+				size_t slotCount = 1024;
+				while (m_hashes.size() * 2 > slotCount)
+					slotCount *= 2;
+				Rehash(slotCount);
+			}
+
+		private:
+			// Returns the slot holding the name, or the empty slot where it belongs
+			size_t FindSlot(const char* name, size_t length, uint32_t hash) const
+			{
+				const size_t mask = m_slots.size() - 1;
+				for (size_t slot = hash & mask; ; slot = (slot + 1) & mask)
+				{
+					const auto symbol = m_slots[slot];
+					if (symbol == InvalidSymbol)
+						return slot;
+					if (m_hashes[symbol] == hash)
+					{
+						const auto& existing = GetName(symbol);
+						if (existing.size() == length && std::memcmp(existing.data(), name, length) == 0)
+							return slot;
+					}
+				}
+			}
+
+			void Rehash(size_t slotCount)
+			{
+				std::vector<Symbol> slots(slotCount, InvalidSymbol);
+				const size_t mask = slots.size() - 1;
+				for (Symbol symbol = 0; symbol < m_hashes.size(); ++symbol)
+				{
+					size_t slot = m_hashes[symbol] & mask;
+					while (slots[slot] != InvalidSymbol)
+						slot = (slot + 1) & mask;
+					slots[slot] = symbol;
+				}
+				m_slots.swap(slots);
+			}
+
+			std::shared_timed_mutex m_mutex;
+			std::vector<Symbol> m_slots;     // Open addressing hash table of symbols
+			std::vector<uint32_t> m_hashes;  // Indexed by symbol
+			std::unique_ptr<std::string[]> m_chunks[MaxChunks];
+			std::atomic<size_t> m_size;
+		};
+
+		Table& GetTable()
+		{
+			static Table table;
+			return table;
+		}
+	}
+
+	Symbol Intern(const char* name, size_t length)
+	{
+		return GetTable().Intern(name, length);
+	}
+
+	const std::string& GetName(Symbol symbol)
+	{
+		return GetTable().GetName(symbol);
+	}
+
+	size_t Size()
+	{
+		return GetTable().Size();
+	}
+
+	void Truncate(size_t size)
+	{
+		GetTable().Truncate(size);
+	}
+}
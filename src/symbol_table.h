@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// Identifiers are interned once into a process-wide table and passed through the pipeline as 32-bit ids, so
+// comparing and copying names is an integer operation.
+using Symbol = uint32_t;
+
+namespace SymbolTable
+{
+	const Symbol InvalidSymbol = ~Symbol(0);
+
+	// Returns the id for the given name, adding it on first use. Thread-safe.
+	Symbol Intern(const char* name, size_t length);
+	inline Symbol Intern(const std::string& name) { return Intern(name.data(), name.size()); }
+
+	// Lock-free; the reference stays valid until the symbol is removed by Truncate
+	const std::string& GetName(Symbol symbol);
+
+	size_t Size();
+
+	// Removes every symbol but the first size, so their ids and memory can be reused. Not thread-safe: call it only
+	// while no other thread uses the table and nothing still holds a removed symbol.
+	void Truncate(size_t size);
+
+	// Without it, every distinct identifier a long-running process (server, watch mode) ever compiled would stay in the
+	// table until it was full, failing every later compile. Construct one once the symbols that outlive a compile
+	// (builtins, default options) are interned, and call Trim between compiles.
+	class Checkpoint
+	{
+	public:
+		// Sized so that trimming is rare but the table never gets close to full
+		static const size_t DefaultMaxSize = size_t(1) << 20;
+
+		explicit Checkpoint(size_t maxSize = DefaultMaxSize) : m_size(Size()), m_maxSize(maxSize) {}
+
+		// Removes the symbols interned since construction, if the table has grown past maxSize
+		void Trim() const
+		{
+			if (Size() > m_maxSize)
+				Truncate(m_size);
+		}
+
+	private:
+		size_t m_size;
+		size_t m_maxSize;
+	};
+}
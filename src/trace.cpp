@@ -0,0 +1,190 @@
+#include "trace.h"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Trace
+{
+	namespace
+	{
+		struct Event
+		{
+			char type; // 'B'egin, 'E'nd or 'C'ounter
+			const char* category;
+			std::string name;
+			int64_t value;
+			double timestampUs;
+		};
+
+		struct ThreadBuffer
+		{
+			int tid;
+			std::string threadName;
+			std::vector<Event> events;
+			bool inUse;
+		};
+
+		std::atomic<bool> g_enabled(false);
+		std::chrono::steady_clock::time_point g_startTime;
+
+		// Buffers are owned here rather than by their threads so that events outlive the worker threads that recorded
+		// them. A buffer released by an exiting thread is handed to the next new thread.
+		std::mutex g_buffersMutex;
+		std::vector<std::unique_ptr<ThreadBuffer>> g_buffers;
+
+		struct ThreadBufferHandle
+		{
+			ThreadBuffer* buffer = nullptr;
+
+			~ThreadBufferHandle()
+			{
+				if (buffer)
+				{
+					std::lock_guard<std::mutex> lock(g_buffersMutex);
+					buffer->inUse = false;
+				}
+			}
+		};
+
+		thread_local ThreadBufferHandle t_bufferHandle;
+
+		ThreadBuffer& GetThreadBuffer()
+		{
+			if (!t_bufferHandle.buffer)
+			{
+				std::lock_guard<std::mutex> lock(g_buffersMutex);
+				for (auto&& buffer : g_buffers)
+				{
+					if (!buffer->inUse)
+					{
+						t_bufferHandle.buffer = buffer.get();
+						break;
+					}
+				}
+				if (!t_bufferHandle.buffer)
+				{
+					g_buffers.emplace_back(new ThreadBuffer{ static_cast<int>(g_buffers.size()) + 1, std::string(), {}, false });
+					t_bufferHandle.buffer = g_buffers.back().get();
+				}
+				t_bufferHandle.buffer->inUse = true;
+			}
+			return *t_bufferHandle.buffer;
+		}
+
+		double NowUs()
+		{
+			return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - g_startTime).count();
+		}
+
+		void Record(char type, const char* category, std::string name, int64_t value = 0)
+		{
+			GetThreadBuffer().events.push_back(Event{ type, category, std::move(name), value, NowUs() });
+		}
+
+		void WriteJsonString(std::ostream& os, const std::string& s)
+		{
+			os << '"';
+			for (char c : s)
+			{
+				if (c == '"' || c == '\\')
+					os << '\\' << c;
+				else if (static_cast<unsigned char>(c) >= 0x20)
+					os << c;
+			}
+			os << '"';
+		}
+	}
+
+	void Start()
+	{
+		std::lock_guard<std::mutex> lock(g_buffersMutex);
+		for (auto&& buffer : g_buffers)
+			buffer->events.clear();
+		g_startTime = std::chrono::steady_clock::now();
+		g_enabled = true;
+	}
+
+	bool StopAndWrite(const std::string& path)
+	{
+		g_enabled = false;
+
+		std::ofstream file(path);
+		if (!file)
+			return false;
+
+		// Timestamps are in microseconds; the default 6 significant digits would round them to 10 us after a second
+		file << std::fixed << std::setprecision(3);
+
+		std::lock_guard<std::mutex> lock(g_buffersMutex);
+		file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+		bool first = true;
+		auto Separator = [&first]() { const char* s = first ? "  " : ",\n  "; first = false; return s; };
+
+		for (auto&& buffer : g_buffers)
+		{
+			if (!buffer->threadName.empty())
+			{
+				file << Separator() << "{\"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->tid << ", \"name\": \"thread_name\", \"args\": {\"name\": ";
+				WriteJsonString(file, buffer->threadName);
+				file << "}}";
+			}
+
+			for (auto&& event : buffer->events)
+			{
+				file << Separator() << "{\"ph\": \"" << event.type << "\", \"pid\": 1, \"tid\": " << buffer->tid << ", \"ts\": " << event.timestampUs;
+				if (event.type != 'E')
+				{
+					file << ", \"cat\": \"" << event.category << "\", \"name\": ";
+					WriteJsonString(file, event.name);
+				}
+				if (event.type == 'C')
+					file << ", \"args\": {\"value\": " << event.value << "}";
+				file << "}";
+			}
+		}
+
+		file << "\n]}\n";
+		return static_cast<bool>(file);
+	}
+
+	bool IsEnabled()
+	{
+		return g_enabled.load(std::memory_order_relaxed);
+	}
+
+	void SetThreadName(const std::string& name)
+	{
+		if (IsEnabled())
+			GetThreadBuffer().threadName = name;
+	}
+
+	void Counter(const char* name, int64_t value)
+	{
+		if (IsEnabled())
+			Record('C', "counter", name, value);
+	}
+
+	Scope::Scope(const char* category, const char* name)
+		: m_active(IsEnabled())
+	{
+		if (m_active)
+			Record('B', category, name);
+	}
+
+	Scope::Scope(const char* category, const std::string& name)
+		: m_active(IsEnabled())
+	{
+		if (m_active)
+			Record('B', category, name);
+	}
+
+	Scope::~Scope()
+	{
+		if (m_active)
+			Record('E', nullptr, std::string());
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// Timeline recording in Chrome trace-event format (loadable in chrome://tracing and Perfetto). Each thread appends
+// to its own buffer without locking; buffers are only merged when the trace is written.
+namespace Trace
+{
+	// Discards previously recorded events and starts recording
+	void Start();
+
+	// Stops recording and writes the trace to path. No other thread may be recording at this point.
+	bool StopAndWrite(const std::string& path);
+
+	bool IsEnabled();
+
+	// Names the calling thread's track in the timeline
+	void SetThreadName(const std::string& name);
+
+	// Records a sample of a counter track (e.g. queue depth)
+	void Counter(const char* name, int64_t value);
+
+	// Records a begin event on construction and the matching end event on destruction
+	class Scope
+	{
+	public:
+		Scope(const char* category, const char* name);
+		Scope(const char* category, const std::string& name);
+		~Scope();
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		bool m_active;
+	};
+}
@@ -1,7 +1,21 @@
 #pragma once
 
-#include <experimental/variant.hpp>
+#include <cassert>
+#include <tuple>
 #include <type_traits>
+#include <utility>
+
+// variant_lib names the variant implementation: C++17's std::variant when built with TINYCOMPILER_STD_VARIANT,
+// otherwise the std::experimental::variant of the external/variant submodule
+#if TINYCOMPILER_STD_VARIANT
+
+#include <variant>
+
+namespace variant_lib = std;
+
+#else
+
+#include <experimental/variant.hpp>
 
 // Add missing variant_size and variant_size_v (Submitted a PR for this)
 namespace std {
@@ -16,34 +30,106 @@ namespace std {
 	}
 }
 
+namespace variant_lib = std::experimental;
+
+#endif
+
 namespace match_detail
 {
-	using namespace std::experimental;
+	using namespace variant_lib;
 	using namespace std;
 
-	template <int variant_index, typename VariantType, typename OneFunc>
-	constexpr void match(VariantType&& variant, OneFunc func)
+	template <size_t variant_index, typename VariantType, typename... Funcs>
+	using call_result_t = decltype(declval<tuple_element_t<variant_index, tuple<Funcs&&...>>>()(get<variant_index>(declval<VariantType>())));
+
+	// All functions must return the same type, or types with a common type
+	template <typename VariantType, typename IndexSequence, typename... Funcs>
+	struct result;
+
+	template <typename VariantType, size_t... variant_indices, typename... Funcs>
+	struct result<VariantType, index_sequence<variant_indices...>, Funcs...>
 	{
-		assert(variant.index() == variant_index);
-		func(get<variant_index>(std::forward<VariantType>(variant)));
-	}
+		using type = common_type_t<call_result_t<variant_indices, VariantType, Funcs...>...>;
+	};
 
-	template <int variant_index, typename VariantType, typename FirstFunc, typename SecondFunc, typename... Rest>
-	constexpr void match(VariantType&& variant, FirstFunc func1, SecondFunc func2, Rest... funcs)
+#if TINYCOMPILER_STD_VARIANT
+
+	// std::visit picks the function by the type of the active alternative rather than its index, so the types must
+	// be distinct
+	template <typename T, typename... Ts>
+	constexpr bool occurs_once = (0 + ... + is_same<T, Ts>::value) == 1;
+
+	// Takes the alternative with the value category and constness of the variant it was matched from
+	template <typename Result, typename Alternative, typename Func>
+	struct alternative_caller
 	{
-		if (variant.index() == variant_index)
+		Func&& func;
+
+		Result operator()(Alternative alternative) const
 		{
-			match<variant_index>(variant, func1); // Call single func version
-			return;
+			return std::forward<Func>(func)(std::forward<Alternative>(alternative));
 		}
-		return match<variant_index + 1>(std::forward<VariantType>(variant), func2, funcs...);
+	};
+
+	template <typename... Callers>
+	struct visitor : Callers...
+	{
+		using Callers::operator()...;
+	};
+
+	// Leaves dispatch to the standard library's std::visit
+	template <typename Result, typename VariantType, size_t... variant_indices, typename... Funcs>
+	Result dispatch(index_sequence<variant_indices...>, VariantType&& variant, Funcs&&... funcs)
+	{
+		using VT = remove_cv_t<remove_reference_t<VariantType>>;
+		static_assert((occurs_once<variant_alternative_t<variant_indices, VT>, variant_alternative_t<variant_indices, VT>...> && ...),
+			"With std::variant, match requires the alternatives to be distinct types");
+
+		visitor<alternative_caller<Result, decltype(get<variant_indices>(declval<VariantType>())), Funcs>...> callers{ { std::forward<Funcs>(funcs) }... };
+		return visit(callers, std::forward<VariantType>(variant));
 	}
+
+#else
+
+	// Functions are held by reference, except stateless ones, which are copied: a copy behaves the same, and holding
+	// it takes no storage, so the functions of a typical match cost nothing to pass to the dispatch table
+	template <typename Func>
+	using holder_t = conditional_t<is_empty<decay_t<Func>>::value && is_trivially_copy_constructible<decay_t<Func>>::value, decay_t<Func>, Func&&>;
+
+	// Calls the function for one alternative; instantiated once per alternative to fill the dispatch table
+	template <typename Result, size_t variant_index, typename VariantType, typename FuncsTuple, typename... Funcs>
+	Result call(VariantType&& variant, FuncsTuple& funcs)
+	{
+		using Func = tuple_element_t<variant_index, tuple<Funcs...>>;
+		return std::forward<Func>(std::get<variant_index>(funcs))(get<variant_index>(std::forward<VariantType>(variant)));
+	}
+
+	// One indirect call through a table indexed by the active alternative, so the cost doesn't grow with the number
+	// of alternatives
+	template <typename Result, typename VariantType, size_t... variant_indices, typename... Funcs>
+	Result dispatch(index_sequence<variant_indices...>, VariantType&& variant, Funcs&&... funcs)
+	{
+		using FuncsTuple = tuple<holder_t<Funcs>...>;
+		using Caller = Result (*)(VariantType&&, FuncsTuple&);
+		static constexpr Caller callers[] = { &call<Result, variant_indices, VariantType, FuncsTuple, Funcs...>... };
+
+		FuncsTuple funcsTuple(std::forward<Funcs>(funcs)...);
+		const auto index = variant.index();
+		assert(index < sizeof...(variant_indices)); // Not valueless
+		return callers[index](std::forward<VariantType>(variant), funcsTuple);
+	}
+
+#endif
 }
 
+// Calls the function whose position matches the index of the variant's active alternative, and returns its result.
+// Functions are forwarded rather than copied, bar stateless ones (see holder_t).
 template <typename VariantType, typename... Funcs>
-void match(VariantType&& variant, Funcs... funcs)
+decltype(auto) match(VariantType&& variant, Funcs&&... funcs)
 {
-	using VT = std::remove_reference_t<VariantType>;
-	static_assert(sizeof...(funcs) == std::experimental::variant_size_v<VT>, "Number of functions must match number of variant types");
-	match_detail::match<0>(std::forward<VariantType>(variant), funcs...);
+	using VT = std::remove_cv_t<std::remove_reference_t<VariantType>>;
+	static_assert(sizeof...(funcs) == variant_lib::variant_size_v<VT>, "Number of functions must match number of variant types");
+	using Indices = std::make_index_sequence<sizeof...(funcs)>;
+	using Result = typename match_detail::result<VariantType, Indices, Funcs...>::type;
+	return match_detail::dispatch<Result>(Indices{}, std::forward<VariantType>(variant), std::forward<Funcs>(funcs)...);
 }
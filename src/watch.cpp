@@ -0,0 +1,251 @@
+#include "watch.h"
+#include "pipeline.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <unordered_map>
+#include <functional>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#endif
+
+namespace Watch
+{
+#if defined(__linux__)
+	namespace
+	{
+		// After the first event of a burst, wait until the tree has been quiet this long before compiling
+		const int DebounceMilliseconds = 20;
+
+		const uint32_t WatchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE_SELF;
+
+		volatile sig_atomic_t g_stopRequested = 0;
+
+		void OnStopSignal(int)
+		{
+			g_stopRequested = 1;
+		}
+
+		bool EndsWith(const std::string& s, const std::string& suffix)
+		{
+			return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+		}
+
+		bool IsDirectory(const std::string& path)
+		{
+			struct stat st;
+			return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+		}
+
+		class Watcher
+		{
+		public:
+			explicit Watcher(int inotifyFd) : m_inotifyFd(inotifyFd) {}
+
+			// Adds a watch on directory and all its subdirectories, collecting any .lisp files found
+			void AddTree(const std::string& directory, std::set<std::string>& lispFiles)
+			{
+				const int wd = inotify_add_watch(m_inotifyFd, directory.c_str(), WatchMask);
+				if (wd < 0)
+				{
+					std::cerr << "Cannot watch " << directory << ": " << std::strerror(errno) << '\n';
+					return;
+				}
+				m_directories[wd] = directory;
+
+				DIR* dir = opendir(directory.c_str());
+				if (!dir)
+					return;
+				while (auto entry = readdir(dir))
+				{
+					const std::string name = entry->d_name;
+					if (name == "." || name == "..")
+						continue;
+					const auto path = directory + "/" + name;
+					if (IsDirectory(path))
+						AddTree(path, lispFiles);
+					else if (EndsWith(name, ".lisp"))
+						lispFiles.insert(path);
+				}
+				closedir(dir);
+			}
+
+			// Drains all pending inotify events, adding changed .lisp files to pending (a set, so repeated events for
+			// the same file coalesce into one compile)
+			void ReadEvents(std::set<std::string>& pending)
+			{
+				alignas(inotify_event) char buffer[64 * 1024];
+				for (;;)
+				{
+					const auto length = read(m_inotifyFd, buffer, sizeof(buffer));
+					if (length <= 0)
+						return;
+
+					for (char* p = buffer; p < buffer + length; )
+					{
+						const auto event = reinterpret_cast<const inotify_event*>(p);
+						p += sizeof(inotify_event) + event->len;
+
+						auto iter = m_directories.find(event->wd);
+						if (iter == m_directories.end())
+							continue;
+
+						if (event->mask & (IN_DELETE_SELF | IN_IGNORED))
+						{
+							m_directories.erase(iter);
+							continue;
+						}
+						if (event->len == 0)
+							continue;
+
+						const auto path = iter->second + "/" + event->name;
+						if (event->mask & IN_ISDIR)
+						{
+							// Files may already exist in a directory moved or created under us
+							if (event->mask & (IN_CREATE | IN_MOVED_TO))
+								AddTree(path, pending);
+						}
+						else if (EndsWith(path, ".lisp"))
+						{
+							pending.insert(path);
+						}
+					}
+				}
+			}
+
+		private:
+			int m_inotifyFd;
+			std::unordered_map<int, std::string> m_directories;
+		};
+
+		class Compiler
+		{
+		public:
+			void CompileFile(const std::string& lispPath)
+			{
+				const auto startTime = std::chrono::steady_clock::now();
+
+				std::ifstream file(lispPath, std::ios::binary);
+				if (!file)
+					return; // Deleted or renamed away since the event
+
+				// Refilled in place, so the buffer keeps its capacity between compiles. A file still being written is
+				// read again on its next event.
+				file.seekg(0, std::ios::end);
+				m_lispCode.resize(static_cast<size_t>(std::max<std::streamoff>(file.tellg(), 0)));
+				file.seekg(0);
+				file.read(&m_lispCode[0], m_lispCode.size());
+				m_lispCode.resize(static_cast<size_t>(file.gcount()));
+				const auto& lispCode = m_lispCode;
+
+				// Editors often write a file several times per save; skip recompiling identical contents
+				const auto hash = std::hash<std::string>()(lispCode);
+				auto iter = m_lastCompiledHash.find(lispPath);
+				if (iter != m_lastCompiledHash.end() && iter->second == hash)
+					return;
+
+				const auto cppPath = lispPath.substr(0, lispPath.size() - 5) + ".cpp";
+				m_symbols.Trim();
+				try
+				{
+					const auto& cppCode = m_context.CompileToCpp(lispCode, m_options);
+					std::ofstream(cppPath, std::ios::binary) << cppCode;
+					m_lastCompiledHash[lispPath] = hash;
+
+					const auto elapsed = std::chrono::steady_clock::now() - startTime;
+					std::cerr << lispPath << " -> " << cppPath << " ("
+						<< std::chrono::duration<double, std::milli>(elapsed).count() << " ms)\n";
+				}
+				catch (const std::exception& e)
+				{
+					m_lastCompiledHash.erase(lispPath);
+					std::cerr << lispPath << ": error: " << e.what() << '\n';
+				}
+			}
+
+		private:
+			std::string m_lispCode;
+			CompilerContext m_context;
+			CompileOptions m_options;
+			SymbolTable::Checkpoint m_symbols; // After m_options, whose builtins must not be trimmed
+			std::unordered_map<std::string, size_t> m_lastCompiledHash;
+		};
+	}
+
+	int Run(const std::string& directory)
+	{
+		auto root = directory;
+		while (root.size() > 1 && root.back() == '/')
+			root.pop_back();
+
+		if (!IsDirectory(root))
+		{
+			std::cerr << "Not a directory: " << directory << '\n';
+			return 1;
+		}
+
+		const int inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (inotifyFd < 0)
+		{
+			std::perror("inotify_init1");
+			return 1;
+		}
+
+		struct sigaction stopAction;
+		std::memset(&stopAction, 0, sizeof(stopAction));
+		stopAction.sa_handler = OnStopSignal;
+		sigaction(SIGINT, &stopAction, nullptr);
+		sigaction(SIGTERM, &stopAction, nullptr);
+
+		Watcher watcher(inotifyFd);
+		Compiler compiler;
+
+		std::set<std::string> pending;
+		watcher.AddTree(root, pending);
+		std::cerr << "Watching " << root << " (" << pending.size() << " .lisp files)\n";
+
+		while (!g_stopRequested)
+		{
+			for (auto&& path : pending)
+				compiler.CompileFile(path);
+			pending.clear();
+
+			// Block for the first event, then keep collecting until a full debounce interval passes without any
+			pollfd pfd = { inotifyFd, POLLIN, 0 };
+			int timeout = -1;
+			for (;;)
+			{
+				const int ready = poll(&pfd, 1, timeout);
+				if (ready < 0 && errno == EINTR && !g_stopRequested)
+					continue;
+				if (ready <= 0)
+					break;
+				watcher.ReadEvents(pending);
+				timeout = DebounceMilliseconds;
+			}
+		}
+
+		close(inotifyFd);
+		return 0;
+	}
+
+#else
+
+	int Run(const std::string&)
+	{
+		std::cerr << "--watch is only supported on Linux\n";
+		return 1;
+	}
+
+#endif
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+
+// Watch mode: compiles every .lisp file under a directory tree to a .cpp file next to it, then recompiles files as
+// they change until interrupted.
+namespace Watch
+{
+	// Returns the process exit code. Only supported on Linux (inotify).
+	int Run(const std::string& directory);
+}